@@ -1,3 +1,4 @@
 INCLUDEPATH += $$PWD
 SOURCES += $$PWD/mlsdbserialisation.cpp
-HEADERS += $$PWD/mlsdbserialisation.h
+HEADERS += $$PWD/mlsdbserialisation.h \
+    $$PWD/mlsdbcellmeta.h
@@ -0,0 +1,67 @@
+/*
+    Copyright (C) 2022 Jolla Ltd.
+    Contact: Daniel Suni <daniel.suni@jolla.com>
+
+    This file is part of geoclue-mlsdb.
+
+    Geoclue-mlsdb is free software; you can redistribute it and/or
+    modify it under the terms of the GNU Lesser General Public
+    License as published by the Free Software Foundation; either
+    version 2.1 of the License.
+*/
+
+#ifndef GEOCLUE_MLSDB_CELL_META_H
+#define GEOCLUE_MLSDB_CELL_META_H
+// Shared by the tool (C), which writes the metadata, and the provider (C++),
+// which reads it.
+
+#include <math.h>
+
+/*
+Next to each <mcc>.dat file there can be a <mcc>.meta file with two bytes per
+record, in the same order as the records of the .dat file:
+ - the MLS "range" of the cell (the estimated radius of its coverage in
+   metres), stored as ceil(sqrt(range)), which covers ranges up to 65 km
+   with a resolution that is finer for small cells,
+ - the MLS "samples" count of the cell, stored as round(8 * log2(1 + samples)),
+   i.e. in eighths of a doubling.
+A zero byte means that the value is unknown. The .meta file is optional: the
+.dat format does not change, and files without metadata work as before.
+*/
+
+#define MLSDB_META_SIZE 2
+#define MLSDB_META_MAX 255
+
+static inline unsigned char mlsdbEncodeRange(long range)
+{
+    double q;
+    if (range <= 0) {
+        return 0;
+    }
+    q = ceil(sqrt((double)range));
+    return q > MLSDB_META_MAX ? MLSDB_META_MAX : (unsigned char)q;
+}
+
+static inline unsigned char mlsdbEncodeSamples(long samples)
+{
+    double q;
+    if (samples <= 0) {
+        return 0;
+    }
+    q = floor(8.0 * log2(1.0 + (double)samples) + 0.5);
+    return q > MLSDB_META_MAX ? MLSDB_META_MAX : (unsigned char)q;
+}
+
+// Returns the range in metres, or 0 if unknown.
+static inline double mlsdbDecodeRange(unsigned char q)
+{
+    return (double)q * q;
+}
+
+// Returns the (approximate) number of samples, or 0 if unknown.
+static inline double mlsdbDecodeSamples(unsigned char q)
+{
+    return exp2(q / 8.0) - 1.0;
+}
+
+#endif // GEOCLUE_MLSDB_CELL_META_H
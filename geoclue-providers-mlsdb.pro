@@ -1,3 +1,3 @@
 TEMPLATE=subdirs
-SUBDIRS=plugin mlsdbtool mlsdbdata agreements
+SUBDIRS=plugin mlsdbtool mlsdbdata agreements tests
 OTHER_FILES = rpm/geoclue-providers-mlsdb.spec
@@ -0,0 +1,62 @@
+#!/bin/bash
+set -e
+
+# Benchmarks geoclue-mlsdb-tool with synthetic data from mlsdbgen.c, so that
+# builds of any size can be measured without the real MLS export. The data
+# only depends on the generator options, so results are comparable between
+# machines and versions of the tool.
+#
+# Reports the ingestion throughput and the peak RSS of the tool, as well as
+# the size of the output. The generated CSV is kept in the work directory
+# and reused by later runs with the same options.
+
+rundir=`cd \`dirname $0\` && pwd`
+TOOL=${TOOL:-$rundir/geoclue-mlsdb-tool}
+GEN=${GEN:-$rundir/mlsdbgen}
+workdir=${WORKDIR:-/tmp/mlsdb-benchmark}
+
+rows=$1
+if [ -z "$rows" ] ; then
+    echo "Usage: $0 [rows] [generator options] [-- tool options]" >&2
+    echo "Example: $0 10000000 -s 2 -m 244:1,404:4 -- -j 4 -m 512" >&2
+    echo "Set COMPRESS=1 to benchmark gzip compressed input." >&2
+    exit 1
+fi
+shift
+genopts=()
+while [ $# -gt 0 ] && [ "$1" != "--" ] ; do
+    genopts+=("$1")
+    shift
+done
+[ "$1" == "--" ] && shift
+
+if [ ! -x "$TOOL" ] ; then
+    echo "ERROR: Can't find executable $TOOL" >&2
+    exit 1
+fi
+if [ ! -x "$GEN" ] ; then
+    GEN=$workdir/mlsdbgen
+    mkdir -p $workdir
+    ${CC:-cc} -O2 -o $GEN $rundir/mlsdbgen.c -lm
+fi
+
+mkdir -p $workdir/out
+csv=$workdir/data-$rows`echo "${genopts[@]}" | tr -c '[:alnum:]' '_'`.csv
+if [ ! -e "$csv" ] ; then
+    echo "Generating $rows rows into $csv"
+    $GEN -n $rows "${genopts[@]}" > $csv.tmp
+    mv $csv.tmp $csv
+fi
+input=$csv
+if [ -n "$COMPRESS" ] ; then
+    if [ ! -e "$csv.gz" ] ; then
+        gzip -c $csv > $csv.gz.tmp
+        mv $csv.gz.tmp $csv.gz
+    fi
+    input=$csv.gz
+fi
+
+rm -f $workdir/out/*
+echo "Input: `du -h $input | cut -f1` in $input"
+(cd $workdir/out && $TOOL "$@" $input)
+echo "Output: `ls $workdir/out | wc -l` files, `du -cb $workdir/out/* | tail -1 | cut -f1` bytes"
@@ -0,0 +1,239 @@
+/*
+  Copyright (C) 2022 Jolla Ltd.
+  Contact: Daniel Suni <daniel.suni@jolla.com>
+
+  This file is part of geoclue-mlsdb.
+
+  Geoclue-mlsdb is free software; you can redistribute it and/or
+  modify it under the terms of the GNU Lesser General Public
+  License as published by the Free Software Foundation; either
+  version 2.1 of the License.
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "builder.h"
+#include "datwriter.h"
+
+struct finish_worker {
+    pthread_t thread;
+    struct builder *builder;
+    size_t *next_shard;
+    pthread_mutex_t *lock;
+    int error;
+};
+
+int builder_init(struct builder *builder, size_t memory_budget, unsigned thread_count,
+                 const char *tmp_dir, const char *output_dir)
+{
+    size_t i;
+    memset(builder, 0, sizeof(*builder));
+    pthread_mutex_init(&builder->budget_lock, NULL);
+    pthread_mutex_init(&builder->spill_lock, NULL);
+    // Sorting needs a scratch area as large as the data itself.
+    builder->max_buffered = memory_budget / (2 * sizeof(struct mlsdb_record));
+    builder->output_dir = output_dir;
+    for (i = 0; i < MAX_MCC_INDEX; ++i) {
+        pthread_mutex_init(&builder->shards[i].lock, NULL);
+        // The shards are merged in parallel, so each gets its share of the
+        // budget for merge buffers.
+        record_sorter_init(&builder->shards[i].sorter, memory_budget / (thread_count ? thread_count : 1), tmp_dir);
+        builder->shards[i].sorter.spill_when_full = 0;
+    }
+    return 0;
+}
+
+// Spills the largest shards until half of the memory budget is free again.
+static int builder_spill(struct builder *builder)
+{
+    int error = 0;
+    pthread_mutex_lock(&builder->spill_lock);
+    for (;;) {
+        struct builder_shard *largest = NULL;
+        size_t largest_count = 0, spilled, i;
+
+        pthread_mutex_lock(&builder->budget_lock);
+        if (builder->buffered <= builder->max_buffered / 2) {
+            pthread_mutex_unlock(&builder->budget_lock);
+            break;
+        }
+        pthread_mutex_unlock(&builder->budget_lock);
+
+        for (i = 0; i < MAX_MCC_INDEX; ++i) {
+            // Reading the count without the lock is fine for picking a shard.
+            size_t count = __atomic_load_n(&builder->shards[i].sorter.count, __ATOMIC_RELAXED);
+            if (count > largest_count) {
+                largest_count = count;
+                largest = &builder->shards[i];
+            }
+        }
+        if (largest == NULL) {
+            break;
+        }
+
+        pthread_mutex_lock(&largest->lock);
+        spilled = largest->sorter.count;
+        error = record_sorter_spill(&largest->sorter);
+        if (!error) {
+            // Still under the shard lock, so that all of the spilled records
+            // have been counted by builder_add().
+            pthread_mutex_lock(&builder->budget_lock);
+            builder->buffered -= spilled;
+            pthread_mutex_unlock(&builder->budget_lock);
+        }
+        pthread_mutex_unlock(&largest->lock);
+        if (error) {
+            break;
+        }
+    }
+    pthread_mutex_unlock(&builder->spill_lock);
+    return error;
+}
+
+int builder_add(struct builder *builder, const struct mlsdb_record *records, size_t count,
+                struct mlsdb_record *scratch)
+{
+    size_t offsets[MAX_MCC_INDEX + 1];
+    size_t i, over;
+
+    // Group the records by shard, so every shard is locked only once.
+    memset(offsets, 0, sizeof(offsets));
+    for (i = 0; i < count; ++i) {
+        ++offsets[record_mcc_index(&records[i]) + 1];
+    }
+    for (i = 1; i <= MAX_MCC_INDEX; ++i) {
+        offsets[i] += offsets[i - 1];
+    }
+    for (i = 0; i < count; ++i) {
+        scratch[offsets[record_mcc_index(&records[i])]++] = records[i];
+    }
+    // offsets[i] now points to the end of group i.
+    for (i = 0; i < MAX_MCC_INDEX; ++i) {
+        size_t start = i ? offsets[i - 1] : 0;
+        size_t n = offsets[i] - start;
+        struct builder_shard *shard = &builder->shards[i];
+        int error;
+        if (n == 0) {
+            continue;
+        }
+        pthread_mutex_lock(&shard->lock);
+        error = record_sorter_add_many(&shard->sorter, &scratch[start], n);
+        shard->total += n;
+        // Counted before the shard lock is released, as a concurrent
+        // builder_spill() may spill the records right after that.
+        if (!error) {
+            pthread_mutex_lock(&builder->budget_lock);
+            builder->buffered += n;
+            pthread_mutex_unlock(&builder->budget_lock);
+        }
+        pthread_mutex_unlock(&shard->lock);
+        if (error) {
+            return 1;
+        }
+    }
+
+    pthread_mutex_lock(&builder->budget_lock);
+    over = builder->buffered > builder->max_buffered;
+    pthread_mutex_unlock(&builder->budget_lock);
+    return over ? builder_spill(builder) : 0;
+}
+
+static int write_shard_record(const struct mlsdb_record *record, void *context)
+{
+    return dat_writer_add(context, record);
+}
+
+static int builder_finish_shard(struct builder *builder, size_t index)
+{
+    struct builder_shard *shard = &builder->shards[index];
+    struct dat_writer writer;
+
+    if (shard->total == 0) {
+        return 0;
+    }
+    if (dat_writer_open(&writer, builder->output_dir, mccMap[index], shard->total) != 0) {
+        return 1;
+    }
+    if (record_sorter_finish(&shard->sorter, write_shard_record, &writer) != 0) {
+        dat_writer_abort(&writer);
+        return 1;
+    }
+    record_sorter_free(&shard->sorter);
+    return dat_writer_close(&writer);
+}
+
+static void *finish_worker_main(void *data)
+{
+    struct finish_worker *worker = data;
+    for (;;) {
+        size_t index;
+        pthread_mutex_lock(worker->lock);
+        index = (*worker->next_shard)++;
+        pthread_mutex_unlock(worker->lock);
+        if (index >= MAX_MCC_INDEX) {
+            break;
+        }
+        if (builder_finish_shard(worker->builder, index) != 0) {
+            worker->error = 1;
+            break;
+        }
+    }
+    return NULL;
+}
+
+int builder_finish(struct builder *builder, unsigned thread_count)
+{
+    struct finish_worker *workers;
+    pthread_mutex_t lock;
+    size_t next_shard = 0, i;
+    unsigned t, started = 0;
+    int error = 0;
+
+    if (thread_count == 0) {
+        thread_count = 1;
+    }
+    workers = calloc(thread_count, sizeof(struct finish_worker));
+    if (workers == NULL) {
+        fprintf(stderr, "ERROR: Out of memory while writing data files\n");
+        return 1;
+    }
+    pthread_mutex_init(&lock, NULL);
+    for (t = 0; t < thread_count; ++t) {
+        workers[t].builder = builder;
+        workers[t].next_shard = &next_shard;
+        workers[t].lock = &lock;
+        if (pthread_create(&workers[t].thread, NULL, finish_worker_main, &workers[t]) != 0) {
+            fprintf(stderr, "ERROR: Unable to start worker thread\n");
+            error = 1;
+            break;
+        }
+        ++started;
+    }
+    for (t = 0; t < started; ++t) {
+        pthread_join(workers[t].thread, NULL);
+        error |= workers[t].error;
+    }
+    pthread_mutex_destroy(&lock);
+    free(workers);
+
+    for (i = 0; i < MAX_MCC_INDEX; ++i) {
+        if (builder->shards[i].total > 0) {
+            builder->total_records += builder->shards[i].total;
+            ++builder->file_count;
+        }
+    }
+    return error;
+}
+
+void builder_free(struct builder *builder)
+{
+    size_t i;
+    for (i = 0; i < MAX_MCC_INDEX; ++i) {
+        record_sorter_free(&builder->shards[i].sorter);
+        pthread_mutex_destroy(&builder->shards[i].lock);
+    }
+    pthread_mutex_destroy(&builder->spill_lock);
+    pthread_mutex_destroy(&builder->budget_lock);
+}
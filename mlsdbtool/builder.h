@@ -0,0 +1,59 @@
+/*
+  Copyright (C) 2022 Jolla Ltd.
+  Contact: Daniel Suni <daniel.suni@jolla.com>
+
+  This file is part of geoclue-mlsdb.
+
+  Geoclue-mlsdb is free software; you can redistribute it and/or
+  modify it under the terms of the GNU Lesser General Public
+  License as published by the Free Software Foundation; either
+  version 2.1 of the License.
+*/
+
+#ifndef GEOCLUE_MLSDB_TOOL_BUILDER_H
+#define GEOCLUE_MLSDB_TOOL_BUILDER_H
+
+#include <stddef.h>
+#include <pthread.h>
+
+#include "record.h"
+#include "recordsort.h"
+
+/*
+Collects records into one shard per mcc, each with a sorter of its own, so
+that the .dat files can be sorted and written independently of each other.
+Records can be added from several threads at once.
+
+The memory budget is shared by all the shards. When it runs out, the largest
+shards are spilled into temporary runs until half of the budget is free.
+Since the sorters order records completely (see recordsort.h), the output
+does not depend on how the input was split between threads.
+*/
+
+struct builder_shard {
+    pthread_mutex_t lock;
+    struct record_sorter sorter;
+    size_t total;
+};
+
+struct builder {
+    struct builder_shard shards[MAX_MCC_INDEX];
+    pthread_mutex_t budget_lock;
+    pthread_mutex_t spill_lock;
+    size_t buffered;
+    size_t max_buffered;
+    const char *output_dir;
+    size_t total_records;
+    size_t file_count;
+};
+
+int builder_init(struct builder *builder, size_t memory_budget, unsigned thread_count,
+                 const char *tmp_dir, const char *output_dir);
+// Adds records of any mccs. scratch must have room for count records.
+int builder_add(struct builder *builder, const struct mlsdb_record *records, size_t count,
+                struct mlsdb_record *scratch);
+// Sorts and writes all the shards, using thread_count threads.
+int builder_finish(struct builder *builder, unsigned thread_count);
+void builder_free(struct builder *builder);
+
+#endif // GEOCLUE_MLSDB_TOOL_BUILDER_H
@@ -0,0 +1,265 @@
+/*
+  Copyright (C) 2022 Jolla Ltd.
+  Contact: Daniel Suni <daniel.suni@jolla.com>
+
+  This file is part of geoclue-mlsdb.
+
+  Geoclue-mlsdb is free software; you can redistribute it and/or
+  modify it under the terms of the GNU Lesser General Public
+  License as published by the Free Software Foundation; either
+  version 2.1 of the License.
+*/
+
+#define _GNU_SOURCE // memrchr()
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <zlib.h>
+
+#include "chunkreader.h"
+
+#define NEWLINE 10
+#define CHUNKS_PER_THREAD 2
+#define GZIP_BUFFER_SIZE (1024 * 1024)
+
+struct chunk {
+    char *data;
+    size_t size;
+    size_t sequence;
+    struct chunk *next;
+};
+
+struct chunk_queue {
+    pthread_mutex_t lock;
+    pthread_cond_t changed;
+    struct chunk *head;
+    struct chunk *tail;
+    struct chunk *free_list;
+    int done;
+    int error;
+    chunk_fn fn;
+};
+
+struct chunk_worker {
+    pthread_t thread;
+    struct chunk_queue *queue;
+    void *context;
+};
+
+static void *chunk_worker_main(void *data)
+{
+    struct chunk_worker *worker = data;
+    struct chunk_queue *queue = worker->queue;
+    struct chunk *chunk;
+    int error;
+
+    for (;;) {
+        pthread_mutex_lock(&queue->lock);
+        while (queue->head == NULL && !queue->done) {
+            pthread_cond_wait(&queue->changed, &queue->lock);
+        }
+        chunk = queue->head;
+        if (chunk == NULL) {
+            pthread_mutex_unlock(&queue->lock);
+            break;
+        }
+        queue->head = chunk->next;
+        if (queue->head == NULL) {
+            queue->tail = NULL;
+        }
+        error = queue->error;
+        pthread_mutex_unlock(&queue->lock);
+
+        if (!error) {
+            error = queue->fn(chunk->data, chunk->size, chunk->sequence, worker->context);
+        }
+
+        pthread_mutex_lock(&queue->lock);
+        if (error) {
+            queue->error = 1;
+        }
+        chunk->next = queue->free_list;
+        queue->free_list = chunk;
+        pthread_cond_broadcast(&queue->changed);
+        pthread_mutex_unlock(&queue->lock);
+    }
+    return NULL;
+}
+
+// Fills buffer from the input. Returns the number of bytes read, which is
+// only less than size at the end of the input, or -1 on error.
+static ssize_t read_full(gzFile in, char *buffer, size_t size)
+{
+    size_t done = 0;
+    while (done < size) {
+        int bytes = gzread(in, buffer + done, size - done);
+        if (bytes < 0) {
+            int errnum;
+            const char *message = gzerror(in, &errnum);
+            fprintf(stderr, "ERROR: Unable to read input: %s\n",
+                    errnum == Z_ERRNO ? strerror(errno) : message);
+            return -1;
+        }
+        if (bytes == 0) {
+            break;
+        }
+        done += bytes;
+    }
+    return done;
+}
+
+int read_chunks(int fd, unsigned thread_count, chunk_fn fn, void **contexts, size_t *total_bytes)
+{
+    struct chunk_queue queue;
+    struct chunk_worker *workers;
+    struct chunk *chunks;
+    gzFile in;
+    char carry[MAX_LINE_LENGTH];
+    size_t carried = 0, sequence = 0, chunk_count, i;
+    unsigned started = 0;
+    int error = 0, eof = 0;
+
+    if (thread_count == 0) {
+        thread_count = 1;
+    }
+    // gzip compressed input is decompressed on this thread, overlapping with
+    // the parsing done by the workers. Uncompressed input is passed through.
+    // zlib takes over the fd, and gzclose() closes it.
+    in = gzdopen(fd, "rb");
+    if (in == NULL) {
+        fprintf(stderr, "ERROR: Unable to open input\n");
+        close(fd);
+        return 1;
+    }
+    gzbuffer(in, GZIP_BUFFER_SIZE);
+    chunk_count = thread_count * CHUNKS_PER_THREAD;
+    workers = calloc(thread_count, sizeof(struct chunk_worker));
+    chunks = calloc(chunk_count, sizeof(struct chunk));
+    if (workers == NULL || chunks == NULL) {
+        fprintf(stderr, "ERROR: Unable to allocate input buffers\n");
+        free(workers);
+        free(chunks);
+        gzclose(in);
+        return 1;
+    }
+
+    memset(&queue, 0, sizeof(queue));
+    pthread_mutex_init(&queue.lock, NULL);
+    pthread_cond_init(&queue.changed, NULL);
+    queue.fn = fn;
+    for (i = 0; i < chunk_count; ++i) {
+        // Room for a newline after the last line.
+        chunks[i].data = malloc(READ_CHUNK_SIZE + 1);
+        if (chunks[i].data == NULL) {
+            fprintf(stderr, "ERROR: Unable to allocate input buffers\n");
+            error = 1;
+            break;
+        }
+        chunks[i].next = queue.free_list;
+        queue.free_list = &chunks[i];
+    }
+    for (i = 0; !error && i < thread_count; ++i) {
+        workers[i].queue = &queue;
+        workers[i].context = contexts[i];
+        if (pthread_create(&workers[i].thread, NULL, chunk_worker_main, &workers[i]) != 0) {
+            fprintf(stderr, "ERROR: Unable to start worker thread\n");
+            error = 1;
+            break;
+        }
+        ++started;
+    }
+
+    *total_bytes = 0;
+    while (!error && !eof) {
+        struct chunk *chunk;
+        ssize_t bytes;
+        size_t size;
+        char *last;
+
+        pthread_mutex_lock(&queue.lock);
+        while (queue.free_list == NULL && !queue.error) {
+            pthread_cond_wait(&queue.changed, &queue.lock);
+        }
+        error = queue.error;
+        chunk = queue.free_list;
+        if (!error) {
+            queue.free_list = chunk->next;
+        }
+        pthread_mutex_unlock(&queue.lock);
+        if (error) {
+            break;
+        }
+
+        memcpy(chunk->data, carry, carried);
+        bytes = read_full(in, chunk->data + carried, READ_CHUNK_SIZE - carried);
+        if (bytes < 0) {
+            error = 1;
+            break;
+        }
+        *total_bytes += bytes;
+        size = carried + bytes;
+        carried = 0;
+        if (size < READ_CHUNK_SIZE) {
+            eof = 1;
+            if (size > 0 && chunk->data[size - 1] != NEWLINE) {
+                // Last line of the input lacks a newline.
+                chunk->data[size++] = NEWLINE;
+            }
+        } else {
+            // Carry the incomplete last line over to the next chunk.
+            last = memrchr(chunk->data, NEWLINE, size);
+            carried = last ? size - (last + 1 - chunk->data) : size;
+            if (carried > MAX_LINE_LENGTH) {
+                fprintf(stderr, "ERROR: Encountered a line longer than %d characters\n", MAX_LINE_LENGTH);
+                error = 1;
+                break;
+            }
+            size -= carried;
+            memcpy(carry, chunk->data + size, carried);
+        }
+
+        pthread_mutex_lock(&queue.lock);
+        if (size > 0) {
+            chunk->size = size;
+            chunk->sequence = sequence++;
+            chunk->next = NULL;
+            if (queue.tail) {
+                queue.tail->next = chunk;
+            } else {
+                queue.head = chunk;
+            }
+            queue.tail = chunk;
+        } else {
+            chunk->next = queue.free_list;
+            queue.free_list = chunk;
+        }
+        pthread_cond_broadcast(&queue.changed);
+        pthread_mutex_unlock(&queue.lock);
+    }
+
+    pthread_mutex_lock(&queue.lock);
+    queue.done = 1;
+    if (error) {
+        queue.error = 1;
+    }
+    pthread_cond_broadcast(&queue.changed);
+    pthread_mutex_unlock(&queue.lock);
+    for (i = 0; i < started; ++i) {
+        pthread_join(workers[i].thread, NULL);
+    }
+    error = queue.error;
+
+    pthread_cond_destroy(&queue.changed);
+    pthread_mutex_destroy(&queue.lock);
+    for (i = 0; i < chunk_count; ++i) {
+        free(chunks[i].data);
+    }
+    free(chunks);
+    free(workers);
+    gzclose(in);
+    return error;
+}
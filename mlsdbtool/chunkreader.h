@@ -0,0 +1,37 @@
+/*
+  Copyright (C) 2022 Jolla Ltd.
+  Contact: Daniel Suni <daniel.suni@jolla.com>
+
+  This file is part of geoclue-mlsdb.
+
+  Geoclue-mlsdb is free software; you can redistribute it and/or
+  modify it under the terms of the GNU Lesser General Public
+  License as published by the Free Software Foundation; either
+  version 2.1 of the License.
+*/
+
+#ifndef GEOCLUE_MLSDB_TOOL_CHUNKREADER_H
+#define GEOCLUE_MLSDB_TOOL_CHUNKREADER_H
+
+#include <stddef.h>
+
+#define READ_CHUNK_SIZE (4 * 1024 * 1024) // Input is read in 4 MiB chunks.
+#define MAX_LINE_LENGTH 4096              // No sane MLS data line is longer than this.
+
+/*
+Reads the input, which may be gzip compressed, in large chunks which always
+end at a line boundary, and hands them over to a pool of worker threads.
+Decompression runs on the calling thread while the workers parse. Every
+worker has its own context, so the callback only needs to synchronise
+whatever it shares between the contexts. Chunks are processed in no particular order; the
+sequence number tells where in the input a chunk came from.
+
+The chunk data can be modified in place, and always ends with a newline.
+The input fd is closed once it has been read.
+*/
+
+typedef int (*chunk_fn)(char *data, size_t size, size_t sequence, void *context);
+
+int read_chunks(int fd, unsigned thread_count, chunk_fn fn, void **contexts, size_t *total_bytes);
+
+#endif // GEOCLUE_MLSDB_TOOL_CHUNKREADER_H
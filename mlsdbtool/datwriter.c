@@ -0,0 +1,194 @@
+/*
+  Copyright (C) 2022 Jolla Ltd.
+  Contact: Daniel Suni <daniel.suni@jolla.com>
+
+  This file is part of geoclue-mlsdb.
+
+  Geoclue-mlsdb is free software; you can redistribute it and/or
+  modify it under the terms of the GNU Lesser General Public
+  License as published by the Free Software Foundation; either
+  version 2.1 of the License.
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+
+#include "datwriter.h"
+#include "mlsdbcellmeta.h"
+
+#define WRITE_BUFFER_RECORDS 131072 // 1 MiB per section
+
+static int pwrite_all(int fd, const void *data, size_t size, off_t offset)
+{
+    const char *p = data;
+    while (size > 0) {
+        ssize_t written = pwrite(fd, p, size, offset);
+        if (written < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            return -1;
+        }
+        p += written;
+        size -= written;
+        offset += written;
+    }
+    return 0;
+}
+
+static int dat_writer_flush(struct dat_writer *writer)
+{
+    off_t offset = (off_t)writer->written * sizeof(uint64_t);
+    size_t size = writer->buffered * sizeof(uint64_t);
+    if (writer->buffered == 0) {
+        return 0;
+    }
+    if (pwrite_all(writer->fd, writer->networks, size, offset) != 0 ||
+        pwrite_all(writer->fd, writer->positions, size,
+                   offset + (off_t)writer->count * sizeof(uint64_t)) != 0) {
+        fprintf(stderr, "ERROR: Unable to write %s: %s\n", writer->tmp_fn, strerror(errno));
+        return 1;
+    }
+    if (pwrite_all(writer->meta_fd, writer->metas, writer->buffered * MLSDB_META_SIZE,
+                   (off_t)writer->written * MLSDB_META_SIZE) != 0) {
+        fprintf(stderr, "ERROR: Unable to write %s: %s\n", writer->meta_tmp_fn, strerror(errno));
+        return 1;
+    }
+    writer->written += writer->buffered;
+    writer->buffered = 0;
+    return 0;
+}
+
+int dat_writer_open(struct dat_writer *writer, const char *dir, unsigned mcc, size_t count)
+{
+    memset(writer, 0, sizeof(*writer));
+    writer->fd = -1;
+    writer->meta_fd = -1;
+    writer->mcc = mcc;
+    writer->count = count;
+    if (snprintf(writer->dat_fn, sizeof(writer->dat_fn), "%s/%u.dat", dir, mcc) >= (int)sizeof(writer->dat_fn) ||
+        snprintf(writer->tmp_fn, sizeof(writer->tmp_fn), "%s/%u.dat.tmp", dir, mcc) >= (int)sizeof(writer->tmp_fn) ||
+        snprintf(writer->meta_fn, sizeof(writer->meta_fn), "%s/%u.meta", dir, mcc) >= (int)sizeof(writer->meta_fn) ||
+        snprintf(writer->meta_tmp_fn, sizeof(writer->meta_tmp_fn), "%s/%u.meta.tmp", dir, mcc) >= (int)sizeof(writer->meta_tmp_fn)) {
+        fprintf(stderr, "ERROR: Output directory name %s is too long\n", dir);
+        return 1;
+    }
+    writer->networks = malloc(WRITE_BUFFER_RECORDS * sizeof(uint64_t));
+    writer->positions = malloc(WRITE_BUFFER_RECORDS * sizeof(uint64_t));
+    writer->metas = malloc(WRITE_BUFFER_RECORDS * MLSDB_META_SIZE);
+    if (writer->networks == NULL || writer->positions == NULL || writer->metas == NULL) {
+        fprintf(stderr, "ERROR: Out of memory while opening outfile for mcc %u\n", mcc);
+        dat_writer_abort(writer);
+        return 1;
+    }
+    writer->fd = open(writer->tmp_fn, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    if (writer->fd >= 0) {
+        writer->meta_fd = open(writer->meta_tmp_fn, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    }
+    if (writer->fd < 0 || writer->meta_fd < 0) {
+        fprintf(stderr, "Unable to open outfile for mcc %u.\n", mcc);
+        dat_writer_abort(writer);
+        return 1;
+    }
+    return 0;
+}
+
+int dat_writer_add(struct dat_writer *writer, const struct mlsdb_record *record)
+{
+    uint64_t network = record->key & NETWORK_MASK;
+    if (writer->written + writer->buffered == writer->count) {
+        fprintf(stderr, "ERROR: More records than expected for mcc %u\n", writer->mcc);
+        return 1;
+    }
+    if (network < writer->previous) {
+        fprintf(stderr, "ERROR: The current record has value %lu, which is smaller than the previous %lu\n",
+                network, writer->previous);
+        return 1;
+    }
+    writer->previous = network;
+    writer->networks[writer->buffered] = network;
+    writer->positions[writer->buffered] = record->position;
+    writer->metas[writer->buffered * MLSDB_META_SIZE] = record->meta & 0xFF;
+    writer->metas[writer->buffered * MLSDB_META_SIZE + 1] = record->meta >> 8;
+    if (++writer->buffered == WRITE_BUFFER_RECORDS) {
+        return dat_writer_flush(writer);
+    }
+    return 0;
+}
+
+int dat_writer_close(struct dat_writer *writer)
+{
+    if (dat_writer_flush(writer) != 0) {
+        dat_writer_abort(writer);
+        return 1;
+    }
+    if (writer->written != writer->count) {
+        fprintf(stderr, "ERROR: Expected %zu records for mcc %u, got %zu\n",
+                writer->count, writer->mcc, writer->written);
+        dat_writer_abort(writer);
+        return 1;
+    }
+    if (fsync(writer->meta_fd) != 0 || close(writer->meta_fd) != 0) {
+        writer->meta_fd = -1;
+        fprintf(stderr, "ERROR: Unable to write %s: %s\n", writer->meta_tmp_fn, strerror(errno));
+        dat_writer_abort(writer);
+        return 1;
+    }
+    writer->meta_fd = -1;
+    if (fsync(writer->fd) != 0 || close(writer->fd) != 0) {
+        writer->fd = -1;
+        fprintf(stderr, "ERROR: Unable to write %s: %s\n", writer->tmp_fn, strerror(errno));
+        dat_writer_abort(writer);
+        return 1;
+    }
+    writer->fd = -1;
+    // The positions matter more than the metadata, so the .dat goes first. If
+    // the .meta can't follow, the old one no longer lines up with the records
+    // and is removed.
+    if (rename(writer->tmp_fn, writer->dat_fn) != 0) {
+        fprintf(stderr, "ERROR: Unable to rename %s to %s: %s\n", writer->tmp_fn, writer->dat_fn, strerror(errno));
+        dat_writer_abort(writer);
+        return 1;
+    }
+    if (rename(writer->meta_tmp_fn, writer->meta_fn) != 0) {
+        fprintf(stderr, "ERROR: Unable to rename %s to %s: %s\n", writer->meta_tmp_fn, writer->meta_fn, strerror(errno));
+        unlink(writer->meta_fn);
+        dat_writer_abort(writer);
+        return 1;
+    }
+    free(writer->networks);
+    free(writer->positions);
+    free(writer->metas);
+    writer->networks = NULL;
+    writer->positions = NULL;
+    writer->metas = NULL;
+    return 0;
+}
+
+void dat_writer_abort(struct dat_writer *writer)
+{
+    if (writer->fd >= 0) {
+        close(writer->fd);
+        writer->fd = -1;
+    }
+    if (writer->meta_fd >= 0) {
+        close(writer->meta_fd);
+        writer->meta_fd = -1;
+    }
+    if (writer->tmp_fn[0] != '\0') {
+        unlink(writer->tmp_fn);
+    }
+    if (writer->meta_tmp_fn[0] != '\0') {
+        unlink(writer->meta_tmp_fn);
+    }
+    free(writer->networks);
+    free(writer->positions);
+    free(writer->metas);
+    writer->networks = NULL;
+    writer->positions = NULL;
+    writer->metas = NULL;
+}
@@ -0,0 +1,59 @@
+/*
+  Copyright (C) 2022 Jolla Ltd.
+  Contact: Daniel Suni <daniel.suni@jolla.com>
+
+  This file is part of geoclue-mlsdb.
+
+  Geoclue-mlsdb is free software; you can redistribute it and/or
+  modify it under the terms of the GNU Lesser General Public
+  License as published by the Free Software Foundation; either
+  version 2.1 of the License.
+*/
+
+#ifndef GEOCLUE_MLSDB_TOOL_DATWRITER_H
+#define GEOCLUE_MLSDB_TOOL_DATWRITER_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "record.h"
+
+/*
+Writes a single mcc's .dat file from records passed in key order.
+
+The number of records must be known up front, since the network section
+comes first and the location section starts at half of the file. Both
+sections are buffered and written in large blocks at their final offsets,
+so the file is produced in a single pass. Everything is written into a
+temporary file, which is renamed into place by dat_writer_close().
+
+The per-record metadata goes into a separate .meta file (see
+mlsdbcellmeta.h) in the same way. It is renamed into place after the .dat
+file, as the positions matter more than the metadata. Readers only use a
+.meta file whose size matches its .dat file, and if the .meta can't be
+renamed, the old one is removed.
+*/
+
+struct dat_writer {
+    int fd;
+    int meta_fd;
+    unsigned mcc;
+    size_t count;
+    size_t written;
+    size_t buffered;
+    uint64_t previous;
+    uint64_t *networks;
+    uint64_t *positions;
+    unsigned char *metas;
+    char tmp_fn[4096];
+    char dat_fn[4096];
+    char meta_tmp_fn[4096];
+    char meta_fn[4096];
+};
+
+int dat_writer_open(struct dat_writer *writer, const char *dir, unsigned mcc, size_t count);
+int dat_writer_add(struct dat_writer *writer, const struct mlsdb_record *record);
+int dat_writer_close(struct dat_writer *writer);
+void dat_writer_abort(struct dat_writer *writer);
+
+#endif // GEOCLUE_MLSDB_TOOL_DATWRITER_H
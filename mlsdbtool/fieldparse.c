@@ -0,0 +1,185 @@
+/*
+  Copyright (C) 2022 Jolla Ltd.
+  Contact: Daniel Suni <daniel.suni@jolla.com>
+
+  This file is part of geoclue-mlsdb.
+
+  Geoclue-mlsdb is free software; you can redistribute it and/or
+  modify it under the terms of the GNU Lesser General Public
+  License as published by the Free Software Foundation; either
+  version 2.1 of the License.
+*/
+
+#include <stdlib.h>
+#include <string.h>
+#include <float.h>
+
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
+#include "fieldparse.h"
+
+#define ONES 0x0101010101010101ULL
+#define HIGH_BITS 0x8080808080808080ULL
+#define MAX_DIGITS 19       // Always fits into 64 bits.
+#define MAX_EXACT (1ULL << 53)
+#define MAX_EXACT_DECIMALS 22
+
+#if defined(__BYTE_ORDER__) && __BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__
+#define SWAR_LITTLE_ENDIAN 1
+#endif
+
+static const double powersOfTen[MAX_EXACT_DECIMALS + 1] = {
+    1e0, 1e1, 1e2, 1e3, 1e4, 1e5, 1e6, 1e7, 1e8, 1e9, 1e10, 1e11,
+    1e12, 1e13, 1e14, 1e15, 1e16, 1e17, 1e18, 1e19, 1e20, 1e21, 1e22
+};
+
+static const uint64_t digitScales[9] = {
+    1, 10, 100, 1000, 10000, 100000, 1000000, 10000000, 100000000
+};
+
+size_t find_commas(const char *line, size_t length, size_t *commas, size_t max)
+{
+    size_t count = 0, i = 0;
+
+    if (max == 0) {
+        return 0;
+    }
+#ifdef __SSE2__
+    {
+        const __m128i comma = _mm_set1_epi8(',');
+        for (; i + 16 <= length; i += 16) {
+            __m128i block = _mm_loadu_si128((const __m128i *)(line + i));
+            unsigned mask = (unsigned)_mm_movemask_epi8(_mm_cmpeq_epi8(block, comma));
+            while (mask != 0) {
+                commas[count++] = i + __builtin_ctz(mask);
+                if (count == max) {
+                    return count;
+                }
+                mask &= mask - 1;
+            }
+        }
+    }
+#endif
+#ifdef SWAR_LITTLE_ENDIAN
+    for (; i + 8 <= length; i += 8) {
+        uint64_t word, x, mask;
+        memcpy(&word, line + i, sizeof(word));
+        x = word ^ (ONES * ',');
+        // A high bit is set for exactly the zero bytes of x, i.e. the commas.
+        mask = ~(((x & ~HIGH_BITS) + ~HIGH_BITS) | x | ~HIGH_BITS);
+        while (mask != 0) {
+            commas[count++] = i + __builtin_ctzll(mask) / 8;
+            if (count == max) {
+                return count;
+            }
+            mask &= mask - 1;
+        }
+    }
+#endif
+    for (; i < length; ++i) {
+        if (line[i] == ',') {
+            commas[count++] = i;
+            if (count == max) {
+                break;
+            }
+        }
+    }
+    return count;
+}
+
+// Converts 1 - 8 digits at once. Returns non-zero if there are other characters.
+static int convert_digits(const char *digits, size_t count, uint64_t *value)
+{
+#ifdef SWAR_LITTLE_ENDIAN
+    char buffer[8];
+    uint64_t word;
+
+    // Right align the digits behind leading zeroes.
+    memset(buffer, '0', sizeof(buffer));
+    memcpy(buffer + sizeof(buffer) - count, digits, count);
+    memcpy(&word, buffer, sizeof(word));
+    if ((((word & 0xF0F0F0F0F0F0F0F0ULL) | (((word + 0x0606060606060606ULL) & 0xF0F0F0F0F0F0F0F0ULL) >> 4))
+            != 0x3333333333333333ULL)) {
+        return 1; // Not all of the bytes are in '0' - '9'.
+    }
+    word -= ONES * '0';
+    // Pairs of digits, then groups of four, then all eight.
+    word = (word * 10) + (word >> 8);
+    word = (((word & 0x000000FF000000FFULL) * (100 + (1000000ULL << 32))) +
+            (((word >> 16) & 0x000000FF000000FFULL) * (1 + (10000ULL << 32)))) >> 32;
+    *value = (uint32_t)word;
+    return 0;
+#else
+    uint64_t result = 0;
+    size_t i;
+    for (i = 0; i < count; ++i) {
+        if (digits[i] < '0' || digits[i] > '9') {
+            return 1;
+        }
+        result = result * 10 + (digits[i] - '0');
+    }
+    *value = result;
+    return 0;
+#endif
+}
+
+int parse_unsigned_field(const char *field, size_t length, uint64_t *value)
+{
+    uint64_t result = 0, part;
+    size_t step;
+
+    if (length == 0 || length > MAX_DIGITS) {
+        return 1;
+    }
+    // The first step takes the odd digits, so that the rest come in eights.
+    for (step = length % 8 ? length % 8 : 8; length > 0; step = 8) {
+        if (convert_digits(field, step, &part) != 0) {
+            return 1;
+        }
+        result = result * digitScales[step] + part;
+        field += step;
+        length -= step;
+    }
+    *value = result;
+    return 0;
+}
+
+double parse_decimal_field(const char *field, size_t length)
+{
+    const char *dot = memchr(field, '.', length);
+    const char *digits = field;
+    size_t integer_length, decimals = 0;
+    uint64_t integer = 0, fraction = 0;
+    double result;
+    int negative = 0;
+
+#if FLT_EVAL_METHOD != 0
+    // With excess precision, the division below could round differently.
+    return strtod(field, NULL);
+#endif
+    if (length > 0 && (*digits == '-' || *digits == '+')) {
+        negative = *digits == '-';
+        ++digits;
+        --length;
+    }
+    integer_length = dot ? (size_t)(dot - digits) : length;
+    if (dot) {
+        decimals = length - integer_length - 1;
+    }
+    if (integer_length + decimals == 0 || integer_length + decimals > MAX_DIGITS ||
+        decimals > MAX_EXACT_DECIMALS ||
+        (integer_length > 0 && parse_unsigned_field(digits, integer_length, &integer) != 0) ||
+        (decimals > 0 && parse_unsigned_field(dot + 1, decimals, &fraction) != 0)) {
+        return strtod(field, NULL);
+    }
+    // Both the mantissa and the power of ten are exact, so the division is
+    // the only rounding step, just like in strtod().
+    integer = integer * (uint64_t)powersOfTen[decimals] + fraction;
+    if (integer > MAX_EXACT) {
+        return strtod(field, NULL);
+    }
+    result = (double)integer / powersOfTen[decimals];
+    return negative ? -result : result;
+}
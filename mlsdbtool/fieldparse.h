@@ -0,0 +1,49 @@
+/*
+  Copyright (C) 2022 Jolla Ltd.
+  Contact: Daniel Suni <daniel.suni@jolla.com>
+
+  This file is part of geoclue-mlsdb.
+
+  Geoclue-mlsdb is free software; you can redistribute it and/or
+  modify it under the terms of the GNU Lesser General Public
+  License as published by the Free Software Foundation; either
+  version 2.1 of the License.
+*/
+
+#ifndef GEOCLUE_MLSDB_TOOL_FIELDPARSE_H
+#define GEOCLUE_MLSDB_TOOL_FIELDPARSE_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+/*
+Splitting and number parsing for CSV fields, without copying or modifying the
+line, and without reading past its end.
+
+Commas are searched for 16 bytes at a time with SSE2 where available, and 8
+bytes at a time within a 64 bit word otherwise, with a byte by byte loop for
+the tail of the line. Runs of up to 8 digits are converted with a handful of
+multiplications instead of one step per digit.
+
+Decimal numbers are converted exactly like strtod() (and so atof()) would in
+the C locale, which is what earlier versions of the tool used: when the
+digits fit into 53 bits and there are at most 22 decimals, a single correctly
+rounded division gives the same double as strtod(). Everything else is handed
+to strtod() itself. The result therefore never depends on the code path, the
+locale or the number of threads.
+*/
+
+// Stores the offsets of up to max commas in the line into commas, and
+// returns how many were found.
+size_t find_commas(const char *line, size_t length, size_t *commas, size_t max);
+
+// Parses a field consisting only of decimal digits (at most 19). Returns
+// non-zero if the field is empty or contains anything else.
+int parse_unsigned_field(const char *field, size_t length, uint64_t *value);
+
+// Parses a decimal number such as "-153.9229368". The field must be followed
+// by a character which is not part of a number (e.g. a comma or the NUL at
+// the end of the line), in case strtod() is needed.
+double parse_decimal_field(const char *field, size_t length);
+
+#endif // GEOCLUE_MLSDB_TOOL_FIELDPARSE_H
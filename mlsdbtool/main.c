@@ -14,18 +14,52 @@
 #include <unistd.h>
 #include <stdlib.h>
 #include <stdint.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <time.h>
+#include <sys/resource.h>
+
+#include "record.h"
+#include "parser.h"
+#include "chunkreader.h"
+#include "builder.h"
+#include "update.h"
+#include "verify.h"
+#include "report.h"
 
 #define NEWLINE 10
 #define STDIN 0
 
+#define DEFAULT_MEMORY_BUDGET_MB 1024
+#define INITIAL_PARSE_CAPACITY 65536
+
 /*
 This parser will read MLS full export data in CSV format. Data files can
 be downloaded here: https://location.services.mozilla.com/downloads
 
-The reader assumes the data is numerically sorted by unique cell id and that
-only data lines (i.e. no headers) are passed. To achieve that, run:
-tail -n +2 [CSV file] | sort -t, -k2n,2 -k3n,3 -k4n,4 -k5n,5 -k1,1 | geoclue-mlsdb-tool
-or (preferrably) use the wrapper script.
+The input does not need to be sorted, and a header line is skipped. It can
+be given as a file name or on stdin, and can be gzip compressed, so the
+.csv.gz export can be used as it is downloaded. Run:
+geoclue-mlsdb-tool [-c countries] [-j threads] [-m memory budget in MiB] [-t temporary directory] [-r] [CSV file]
+or (preferrably) use the wrapper script. With -r, a build report is written
+for every .dat file afterwards (see report.h).
+
+The -c option takes a comma separated list of country codes and/or mccs
+(e.g. "IN,FI,AU" or "244,404,405"), so that the data for several countries
+can be built with a single pass over the export. Lines for other mccs are
+dropped as soon as their mcc field has been read. Without -c, every mcc
+known to mccmapping.h is built.
+
+To refresh previously built .dat files in the current directory with an MLS
+differential export (see update.h), run:
+geoclue-mlsdb-tool -u [-c countries] [-r] [diff CSV file]
+Only the mccs which have already been built are updated, unless they are
+selected with -c.
+
+To check the .dat files in the current directory against the CSV file they
+were built from (see verify.h), run:
+geoclue-mlsdb-tool -v [-c countries] [-j threads] [CSV file]
 
 ---
 
@@ -33,155 +67,266 @@ The "network" is allocated as follows:
 0000000000000000000000000000000000000000000000000000000000000000
         \____ ___/\_______ ______/\_____________ ____________/\/
              v            v                     v              v
-          NET: 10b Area: 16 bits        Cell ID: 28 bits     Radio: 2b 
+          NET: 10b Area: 16 bits        Cell ID: 28 bits     Radio: 2b
 
 The "position" is allocated as 2 concatenated 32-bit floats
 with longitude first and then latitude.
 
-This program will produce 2 files per mcc: .ntw for network data and .loc
-for location data. To finalize the mlsdb data file the two should simply
-be concatenated into a .dat file. (The wrapper will do this too.)
+The input is split into chunks which are parsed in parallel by a pool of
+worker threads (one per CPU by default). Each line is encoded into a fixed
+size 24 byte record as soon as it has been parsed (see record.h), and the
+records are collected into one shard per mcc. The shards are then sorted by
+the tool itself with a radix sort and written out in parallel. If the records
+don't fit into the memory budget, sorted runs are written into temporary
+files and merged at the end. The output is the same regardless of the number
+of threads.
+
+This program will produce one .dat file per mcc: first all the network data,
+then all the location data. The file is written under a temporary name and
+renamed into place once complete, so a half-written .dat is never left behind.
+Next to it, a .meta file with the range and sample count of each cell is
+written (see mlsdbcellmeta.h).
 
 Since the network portion and the data portion are exactly the same size,
 the file is simply split so the the 1st half contains network data, and the
 corresponding location data is found in ${net_data_pos} + ${file_size} / 2
 */
-uint64_t network;
-uint64_t position;
-uint64_t previous = 0;
+struct parse_context {
+    struct builder *builder;
+    struct mlsdb_record *records;
+    struct mlsdb_record *scratch;
+    size_t capacity;
+    size_t skipped;
+};
 
-// Helper function for debugging (prints out a 64b int as binary)
-void print_bin(uint64_t n)
+double elapsed_seconds(const struct timespec *start)
 {
-    if (n > 1) {
-        print_bin(n >> 1);
-    }
-    printf("%lu", n & 1);
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (now.tv_sec - start->tv_sec) + (now.tv_nsec - start->tv_nsec) / 1e9;
 }
 
-void add_network(char *str, size_t shift)
+double peak_rss_mb(void)
 {
-    uint64_t t = atoi(str);
-    t <<= shift;
-    network |= t;
+    struct rusage usage;
+    if (getrusage(RUSAGE_SELF, &usage) != 0) {
+        return 0.0;
+    }
+    return usage.ru_maxrss / 1024.0; // ru_maxrss is in KiB.
 }
 
-#pragma GCC diagnostic push
-#pragma GCC diagnostic ignored "-Wstrict-aliasing"
-void add_position(char *str, size_t shift)
+// Parses a chunk of lines and passes the records on to the builder.
+int parse_chunk(char *data, size_t size, size_t sequence, void *context)
 {
-    float f = atof(str);
-    // Pretend the 32b float is a 32b int, and assign the value to a 64b int.
-    uint64_t t = *(uint32_t*)&f;
-    t <<= shift;
-    position |= t;
+    struct parse_context *ctx = context;
+    char *line = data, *end = data + size, *nl;
+    size_t count = 0;
+    (void)sequence;
+
+    while ((nl = memchr(line, NEWLINE, end - line)) != NULL) {
+        *nl = '\0';
+        if (count == ctx->capacity) {
+            size_t capacity = ctx->capacity ? ctx->capacity * 2 : INITIAL_PARSE_CAPACITY;
+            struct mlsdb_record *records = realloc(ctx->records, capacity * sizeof(struct mlsdb_record));
+            struct mlsdb_record *scratch = realloc(ctx->scratch, capacity * sizeof(struct mlsdb_record));
+            if (records) {
+                ctx->records = records;
+            }
+            if (scratch) {
+                ctx->scratch = scratch;
+            }
+            if (records == NULL || scratch == NULL) {
+                fprintf(stderr, "ERROR: Out of memory while parsing\n");
+                return 1;
+            }
+            ctx->capacity = capacity;
+        }
+        if (nl > line) {
+            int result = parse_line(line, nl - line, &ctx->records[count]);
+            if (result == PARSE_RECORD) {
+                ++count;
+            } else if (result == PARSE_SKIPPED) {
+                ++ctx->skipped;
+            }
+        }
+        line = nl + 1;
+    }
+    return builder_add(ctx->builder, ctx->records, count, ctx->scratch);
 }
-#pragma GCC diagnostic pop
 
-void add_radio(char *str)
+// Writes a report for every .dat file of the (selected) mccs in dir.
+int write_reports(const char *dir)
 {
-    switch(str[0]) {
-    case 'G': // GSM
-        break;
-    case 'L': // LTE
-        ++network;
-        break;
-    case 'U': // UMTS
-        network += 2;
-        break;
-    default:
-        network += 3;
-        break;
+    char path[4096];
+    size_t i, count = 0;
+    for (i = 0; mccMap[i] <= MAX_MCC; ++i) {
+        if (mcc_selection_active() && !mcc_selected(mccMap[i])) {
+            continue;
+        }
+        snprintf(path, sizeof(path), "%s/%d.dat", dir, mccMap[i]);
+        if (access(path, F_OK) != 0) {
+            continue;
+        }
+        if (write_report(dir, mccMap[i]) != 0) {
+            return 1;
+        }
+        ++count;
     }
+    fprintf(stderr, "Wrote %zu build reports\n", count);
+    return 0;
+}
+
+void usage(const char *name)
+{
+    fprintf(stderr, "Usage: %s [-c countries] [-j threads] [-m memory budget in MiB] [-t temporary directory] [-r] [CSV file]\n", name);
+    fprintf(stderr, "       %s -u [-c countries] [-r] [diff CSV file]\n", name);
+    fprintf(stderr, "       %s -v [-c countries] [-j threads] [CSV file]\n", name);
+    fprintf(stderr, "Countries are given as a comma separated list of country codes and/or mccs.\n");
+    fprintf(stderr, "With -r, a JSON report is written for every resulting .dat file.\n");
+    fprintf(stderr, "The CSV file may be gzip compressed. If it is not given, stdin is read.\n");
 }
 
-int main()
+int main(int argc, char **argv)
 {
-    char c;
-    char line[150];
-    char mcc_fn[16];
-    char loc_fn[16];
-    size_t pos = 0, count = 0, mcc_old = 0, mcc_num = 0, mcc_p = 0, net_p = 0, area_p = 0, cell_p = 0, lon_p = 0, lat_p = 0;
-    FILE *fp_mcc = NULL, *fp_loc = NULL;
-    while (read(STDIN, &c, 1) > 0) {
-        if (c == NEWLINE) {
-            pos = 0;
-            count = 0;
-            position = 0;
-            network = 0;
-            mcc_num = atoi(&line[mcc_p]);
-            // We have a new mcc; we need to open new files.
-            if (mcc_num != mcc_old) {
-                if (mcc_old > 0) {
-                    fclose(fp_mcc);
-                    fclose(fp_loc);
-                }
-                if (snprintf(mcc_fn, 16, "./%s.ntw", &line[mcc_p]) < 0 ||
-                    snprintf(loc_fn, 16, "./%s.loc", &line[mcc_p]) < 0) {
-                    fprintf(stderr, "ERROR: Encountered an invalid mcc %s\n", &line[mcc_p]);
-                    return 1;
-                }
-                fp_mcc = fopen(mcc_fn, "w");
-                fp_loc = fopen(loc_fn, "w");
-                if (fp_mcc == NULL || fp_loc == NULL) {
-                    fprintf(stderr, "Unable to open outfile for mcc %ld.\n", mcc_num);
-                    return 1;
-                }
-                mcc_old = mcc_num;
-                previous = 0;
+    size_t total_bytes = 0, skipped_records = 0, memory_budget = (size_t)DEFAULT_MEMORY_BUDGET_MB << 20;
+    const char *tmp_dir = ".", *countries = NULL;
+    long thread_count = sysconf(_SC_NPROCESSORS_ONLN);
+    struct timespec start;
+    struct builder builder;
+    struct parse_context *contexts;
+    void **context_ptrs;
+    double seconds;
+    int opt, error, update = 0, verify = 0, report = 0, input = STDIN;
+    long i;
+
+    while ((opt = getopt(argc, argv, "c:j:m:rt:uv")) != -1) {
+        switch (opt) {
+        case 'c':
+            countries = optarg;
+            break;
+        case 'j':
+            thread_count = strtol(optarg, NULL, 10);
+            if (thread_count <= 0) {
+                usage(argv[0]);
+                return 1;
             }
-            add_network(&line[net_p], 46);
-            add_network(&line[area_p], 30);
-            add_network(&line[cell_p], 2);
-            add_radio(line);
-            if (previous > network) {
-                fprintf(stderr, "ERROR: The current record has value %lu, which is smaller than the previous %lu\n", network, previous);
-                fprintf(stderr, "The reader will not be able to properly search a file that isn't sorted correctly. Please check your sort.\n");
+            break;
+        case 'm':
+            memory_budget = (size_t)strtoul(optarg, NULL, 10) << 20;
+            if (memory_budget == 0) {
+                usage(argv[0]);
                 return 1;
             }
-            previous = network;
-            add_position(&line[lon_p], 32);
-            add_position(&line[lat_p], 0);
-            fwrite(&network, sizeof(network), 1, fp_mcc);
-            fwrite(&position, sizeof(position), 1, fp_loc);
+            break;
+        case 'r':
+            report = 1;
+            break;
+        case 't':
+            tmp_dir = optarg;
+            break;
+        case 'u':
+            update = 1;
+            break;
+        case 'v':
+            verify = 1;
+            break;
+        default:
+            usage(argv[0]);
+            return 1;
         }
-        else if (c == ',') {
-            line[pos] = '\0'; // Null instead of comma for later string operations.
-            ++count;
-            ++pos;
-            switch(count) {
-            case 1:
-                mcc_p = pos;
-                break;
-            case 2:
-                net_p = pos;
-                break;
-            case 3:
-                area_p = pos;
-                break;
-            case 4:
-                cell_p = pos;
-                break;
-            case 6:
-                lon_p = pos;
-                break;
-            case 7:
-                lat_p = pos;
-                break;
-            default:
-                break;
-            }
+    }
+    if (thread_count <= 0) {
+        thread_count = 1;
+    }
+    if (optind < argc - 1 || (update && verify) || (verify && report)) {
+        usage(argv[0]);
+        return 1;
+    }
+    if (optind == argc - 1) {
+        input = open(argv[optind], O_RDONLY);
+        if (input < 0) {
+            fprintf(stderr, "ERROR: Can't open infile %s: %s\n", argv[optind], strerror(errno));
+            return 1;
+        }
+    }
+
+    init_mcc_index();
+    if (countries != NULL && select_mccs(countries) != 0) {
+        return 1;
+    }
+    if (update) {
+        struct update_stats stats;
+        clock_gettime(CLOCK_MONOTONIC, &start);
+        if (update_dat_files(input, ".", &total_bytes, &stats) != 0) {
+            return 1;
+        }
+        seconds = elapsed_seconds(&start);
+        if (stats.skipped > 0) {
+            fprintf(stderr, "Skipped %zu records with unusable data\n", stats.skipped);
         }
-        else {
-            line[pos] = c;
-            ++pos;
+        if (stats.unbuilt > 0) {
+            fprintf(stderr, "Ignored %zu records for mccs which have not been built (select them with -c to build them)\n",
+                    stats.unbuilt);
         }
+        fprintf(stderr, "Updated %zu files (%zu inserted, %zu updated, %zu removed) from %.1f MB of diff data in %.2f s\n",
+                stats.files, stats.inserted, stats.updated, stats.removed, total_bytes / 1e6, seconds);
+        return report ? write_reports(".") : 0;
     }
-    if (fp_mcc != NULL) {
-        fclose(fp_mcc);
+
+    if (verify) {
+        struct verify_stats stats;
+        size_t problems;
+        clock_gettime(CLOCK_MONOTONIC, &start);
+        if (verify_dat_files(input, ".", thread_count, &total_bytes, &stats) != 0) {
+            return 1;
+        }
+        seconds = elapsed_seconds(&start);
+        problems = stats.missing + stats.mismatched + stats.duplicates + stats.misordered + stats.extra;
+        if (stats.skipped > 0) {
+            fprintf(stderr, "Skipped %zu records with unusable data\n", stats.skipped);
+        }
+        fprintf(stderr, "Verified %zu records in %zu files against %.1f MB of data in %.2f s with %ld threads, %.1f MB/s\n",
+                stats.checked, stats.files, total_bytes / 1e6, seconds, thread_count,
+                seconds > 0 ? total_bytes / 1e6 / seconds : 0.0);
+        fprintf(stderr, "%zu missing, %zu mismatched, %zu duplicates, %zu out of order, %zu extra: %s\n",
+                stats.missing, stats.mismatched, stats.duplicates, stats.misordered, stats.extra,
+                problems ? "FAILED" : "OK");
+        return problems ? 1 : 0;
     }
-    if (fp_loc != NULL) {
-        fclose(fp_loc);
+
+    builder_init(&builder, memory_budget, thread_count, tmp_dir, ".");
+    contexts = calloc(thread_count, sizeof(struct parse_context));
+    context_ptrs = calloc(thread_count, sizeof(void *));
+    if (contexts == NULL || context_ptrs == NULL) {
+        fprintf(stderr, "ERROR: Out of memory\n");
+        return 1;
     }
-    return 0;
+    for (i = 0; i < thread_count; ++i) {
+        contexts[i].builder = &builder;
+        context_ptrs[i] = &contexts[i];
+    }
+
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    error = read_chunks(input, thread_count, parse_chunk, context_ptrs, &total_bytes);
+    for (i = 0; i < thread_count; ++i) {
+        skipped_records += contexts[i].skipped;
+        free(contexts[i].records);
+        free(contexts[i].scratch);
+    }
+    free(contexts);
+    free(context_ptrs);
+    if (error || builder_finish(&builder, thread_count) != 0) {
+        builder_free(&builder);
+        return 1;
+    }
+    builder_free(&builder);
+
+    seconds = elapsed_seconds(&start);
+    if (skipped_records > 0) {
+        fprintf(stderr, "Skipped %zu records with unusable data\n", skipped_records);
+    }
+    fprintf(stderr, "Processed %zu records into %zu files (%.1f MB) in %.2f s with %ld threads, %.1f MB/s, peak RSS %.1f MiB\n",
+            builder.total_records, builder.file_count, total_bytes / 1e6, seconds, thread_count,
+            seconds > 0 ? total_bytes / 1e6 / seconds : 0.0, peak_rss_mb());
+    return report ? write_reports(".") : 0;
 }
@@ -7,6 +7,7 @@
 declare -i mcc
 HEADER="../common/mccmapping.h"
 SCRIPT="./mccmapping"
+COUNTRIES="./mcccountries.h"
 mcc_file=$1
 if [ -z "$mcc_file" ] ; then
     echo "Usage: $0 [MCC file]" >&2
@@ -20,6 +21,10 @@ if [ ! -e "$SCRIPT" ] ; then
     echo "ERROR: Unable to locate script file $SCRIPT" >&2
     exit 1
 fi
+if [ ! -e "$COUNTRIES" ] ; then
+    echo "ERROR: Unable to locate header $COUNTRIES" >&2
+    exit 1
+fi
 
 mccs=`grep -v ^# "$mcc_file" | cut -d ' ' -f1 | sort -nu | tr '\n' ',' | sed 's/^,//;s/,$/,1024/'`
 count=`echo -n $mccs | tr -dc ',' | wc -c`
@@ -52,4 +57,8 @@ for element in `grep -v ^# $mcc_file | cut -d ' ' -f1,3 | sort -u` ; do
     last_mcc=$mcc
 done
 echo '"' >> $SCRIPT
+
+echo "Updating $COUNTRIES"
+entries=`grep -v ^# $mcc_file | cut -d ' ' -f1,3 | sort -u | sed 's/^\([0-9]*\) \(.*\)$/{\1,"\2"},/' | tr -d '\n'`
+sed -i "s/^static const struct mcc_country mccCountries\[\] =.*/static const struct mcc_country mccCountries[] = \{$entries{0,\"\"}\};/" $COUNTRIES
 echo "Done"
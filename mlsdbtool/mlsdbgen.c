@@ -0,0 +1,239 @@
+/*
+  Copyright (C) 2022 Jolla Ltd.
+  Contact: Daniel Suni <daniel.suni@jolla.com>
+
+  This file is part of geoclue-mlsdb.
+
+  Geoclue-mlsdb is free software; you can redistribute it and/or
+  modify it under the terms of the GNU Lesser General Public
+  License as published by the Free Software Foundation; either
+  version 2.1 of the License.
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <unistd.h>
+#include <math.h>
+
+// This program isn't part of the geoclue-mlsdb -suite per se. It generates
+// synthetic data in the MLS full export CSV format, so that the tool can be
+// tested and benchmarked at any scale without downloading the real export.
+// The output only depends on the options and the seed. It is used by
+// "benchmark.sh", which compiles it if needed:
+// cc -O2 -o mlsdbgen mlsdbgen.c -lm
+//
+// The data has the structure of the real thing: every mcc covers a region of
+// its own, each network of an mcc has its own set of location areas, and the
+// cells of an area are clustered around its centre. Cell ids follow the radio
+// type (16 bit GSM cell ids, RNC + cell id for UMTS, eNodeB + sector for LTE)
+// and are unique within their area, and ranges and sample counts have long
+// tails.
+
+#define MAX_ENTRIES 64
+#define OUTPUT_BUFFER_SIZE (1024 * 1024)
+#define REGION_SIZE 8.0     // Degrees covered by an mcc.
+#define AREA_SPREAD 0.05    // Degrees, standard deviation of cells around an area centre.
+
+struct weighted {
+    char name[16];
+    long value;
+    double weight;
+};
+
+struct weighted_list {
+    struct weighted entries[MAX_ENTRIES];
+    size_t count;
+    double total;
+};
+
+static uint64_t rngState;
+
+// splitmix64, which is tiny, fast and gives the same sequence everywhere.
+static uint64_t next_random(void)
+{
+    uint64_t z = (rngState += 0x9E3779B97F4A7C15ULL);
+    z = (z ^ (z >> 30)) * 0xBF58476D1CE4E5B9ULL;
+    z = (z ^ (z >> 27)) * 0x94D049BB133111EBULL;
+    return z ^ (z >> 31);
+}
+
+// Deterministic hash of a value, for properties which must not depend on
+// the order in which the rows are generated.
+static uint64_t hash(uint64_t value)
+{
+    uint64_t saved = rngState, result;
+    rngState = value;
+    result = next_random();
+    rngState = saved;
+    return result;
+}
+
+static double random_unit(void)
+{
+    return (next_random() >> 11) * (1.0 / 9007199254740992.0);
+}
+
+static uint64_t random_below(uint64_t limit)
+{
+    return next_random() % limit;
+}
+
+static double random_gaussian(void)
+{
+    double u = random_unit(), v = random_unit();
+    return sqrt(-2.0 * log(u > 0 ? u : 1e-300)) * cos(2 * M_PI * v);
+}
+
+static int parse_list(const char *str, struct weighted_list *list)
+{
+    const char *start = str;
+    memset(list, 0, sizeof(*list));
+    while (*start != '\0') {
+        struct weighted *entry = &list->entries[list->count];
+        const char *end = strchr(start, ',');
+        const char *colon;
+        size_t length = end ? (size_t)(end - start) : strlen(start);
+        if (list->count == MAX_ENTRIES) {
+            return 1;
+        }
+        colon = memchr(start, ':', length);
+        if (colon == NULL || colon == start || (size_t)(colon - start) >= sizeof(entry->name)) {
+            return 1;
+        }
+        memcpy(entry->name, start, colon - start);
+        entry->value = strtol(entry->name, NULL, 10);
+        entry->weight = strtod(colon + 1, NULL);
+        if (entry->weight <= 0) {
+            return 1;
+        }
+        list->total += entry->weight;
+        ++list->count;
+        start += length + (end != NULL);
+    }
+    return list->count == 0;
+}
+
+static const struct weighted *pick(const struct weighted_list *list)
+{
+    double r = random_unit() * list->total;
+    size_t i;
+    for (i = 0; i + 1 < list->count; ++i) {
+        if (r < list->entries[i].weight) {
+            break;
+        }
+        r -= list->entries[i].weight;
+    }
+    return &list->entries[i];
+}
+
+// Maps the n:th (from 1) cell of an area to a cell id, so that the ids are unique but
+// not sequential.
+static long cell_id(char radio, uint64_t n)
+{
+    switch (radio) {
+    case 'G':
+        return 1 + (long)((n * 7919) % 65521);
+    case 'U':
+        return (long)((n * 2654435761ULL) & 0xFFFFFFF);
+    case 'L':
+        return (long)(((n / 3 * 2654435761ULL) & 0xFFFFF) << 8 | n % 3);
+    default:
+        return (long)((n * 2654435761ULL) & 0xFFFFFFFFFULL); // NR cell ids don't fit, and are skipped by the tool.
+    }
+}
+
+static void usage(const char *name)
+{
+    fprintf(stderr, "Usage: %s [-n rows] [-s seed] [-m mcc:weight,...] [-r radio:weight,...]\n"
+                    "       [-N networks per mcc] [-a areas per network]\n"
+                    "Defaults: -n 100000 -s 1 -m 244:1,404:4,405:2,505:2 -r GSM:30,UMTS:30,LTE:40 -N 4 -a 200\n",
+            name);
+}
+
+int main(int argc, char **argv)
+{
+    const char *mcc_spec = "244:1,404:4,405:2,505:2";
+    const char *radio_spec = "GSM:30,UMTS:30,LTE:40";
+    struct weighted_list mccs, radios;
+    long rows = 100000, networks = 4, areas = 200, i;
+    uint64_t seed = 1;
+    uint32_t *cells;
+    char *buffer;
+    size_t used = 0;
+    int opt;
+
+    while ((opt = getopt(argc, argv, "n:s:m:r:N:a:")) != -1) {
+        switch (opt) {
+        case 'n':
+            rows = strtol(optarg, NULL, 10);
+            break;
+        case 's':
+            seed = strtoull(optarg, NULL, 10);
+            break;
+        case 'm':
+            mcc_spec = optarg;
+            break;
+        case 'r':
+            radio_spec = optarg;
+            break;
+        case 'N':
+            networks = strtol(optarg, NULL, 10);
+            break;
+        case 'a':
+            areas = strtol(optarg, NULL, 10);
+            break;
+        default:
+            usage(argv[0]);
+            return 1;
+        }
+    }
+    if (rows < 0 || networks <= 0 || networks > 999 || areas <= 0 || areas > 65533 ||
+        parse_list(mcc_spec, &mccs) != 0 || parse_list(radio_spec, &radios) != 0) {
+        usage(argv[0]);
+        return 1;
+    }
+    // The number of cells generated so far in each area, per radio.
+    cells = calloc(mccs.count * networks * areas * radios.count, sizeof(uint32_t));
+    buffer = malloc(OUTPUT_BUFFER_SIZE);
+    if (cells == NULL || buffer == NULL) {
+        fprintf(stderr, "ERROR: Out of memory\n");
+        return 1;
+    }
+
+    rngState = seed;
+    fputs("radio,mcc,net,area,cell,unit,lon,lat,range,samples,changeable,created,updated,averageSignal\n", stdout);
+    for (i = 0; i < rows; ++i) {
+        const struct weighted *mcc = pick(&mccs);
+        const struct weighted *radio = pick(&radios);
+        long net = 1 + random_below(networks);
+        long area = 1 + random_below(areas);
+        uint64_t region = hash(mcc->value);
+        uint64_t centre = hash(((uint64_t)mcc->value << 32) | (net << 16) | area);
+        double lat = -50.0 + (region % 10000) / 10000.0 * 110.0;
+        double lon = -180.0 + ((region >> 16) % 10000) / 10000.0 * (360.0 - REGION_SIZE);
+        long range, samples;
+        uint32_t *cell = &cells[(((mcc - mccs.entries) * networks + net - 1) * areas + area - 1) * radios.count +
+                                (radio - radios.entries)];
+
+        // Area centres are spread over the region of the mcc.
+        lat += (centre % 10000) / 10000.0 * REGION_SIZE + AREA_SPREAD * random_gaussian();
+        lon += ((centre >> 16) % 10000) / 10000.0 * REGION_SIZE + AREA_SPREAD * random_gaussian();
+        range = (long)(1000.0 * exp(1.2 * random_gaussian()));
+        samples = (long)(1.0 / (1.0 - random_unit() * 0.9999));
+
+        if (used > OUTPUT_BUFFER_SIZE - 256) {
+            fwrite(buffer, 1, used, stdout);
+            used = 0;
+        }
+        used += snprintf(buffer + used, OUTPUT_BUFFER_SIZE - used,
+                         "%s,%ld,%ld,%ld,%ld,,%.7f,%.7f,%ld,%ld,1,%ld,%ld,0\n",
+                         radio->name, mcc->value, net, area, cell_id(radio->name[0], ++*cell), lon, lat, range, samples,
+                         1300000000L + (long)random_below(200000000), 1500000000L + (long)random_below(200000000));
+    }
+    fwrite(buffer, 1, used, stdout);
+    free(buffer);
+    free(cells);
+    return fflush(stdout) != 0;
+}
@@ -1,6 +1,30 @@
 TEMPLATE=app
 TARGET=geoclue-mlsdb-tool
 QT=
-SOURCES += main.c
+INCLUDEPATH += $$PWD/../common
+LIBS += -lpthread -lz -lm
+HEADERS += \
+    record.h \
+    parser.h \
+    recordsort.h \
+    datwriter.h \
+    chunkreader.h \
+    mcccountries.h \
+    builder.h \
+    update.h \
+    verify.h \
+    report.h \
+    fieldparse.h
+SOURCES += \
+    main.c \
+    parser.c \
+    recordsort.c \
+    datwriter.c \
+    chunkreader.c \
+    builder.c \
+    update.c \
+    verify.c \
+    report.c \
+    fieldparse.c
 target.path=/usr/bin
 INSTALLS=target
@@ -0,0 +1,258 @@
+/*
+  Copyright (C) 2022 Jolla Ltd.
+  Contact: Daniel Suni <daniel.suni@jolla.com>
+
+  This file is part of geoclue-mlsdb.
+
+  Geoclue-mlsdb is free software; you can redistribute it and/or
+  modify it under the terms of the GNU Lesser General Public
+  License as published by the Free Software Foundation; either
+  version 2.1 of the License.
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <ctype.h>
+#include <limits.h>
+
+#include "mccmapping.h"
+#include "mcccountries.h"
+#include "mlsdbcellmeta.h"
+#include "parser.h"
+#include "fieldparse.h"
+
+// radio,mcc,net,area,cell,unit,lon,lat,range,samples,... are needed, and the
+// samples field ends at the 10th comma.
+#define PARSED_FIELDS 10
+// The n:th field (from 0) starts after the n:th comma, and ends at the next
+// one or at the end of the line.
+#define FIELD(n) (line + commas[(n) - 1] + 1)
+#define FIELD_LENGTH(n) ((n) < count ? commas[n] - commas[(n) - 1] - 1 : length - commas[(n) - 1] - 1)
+
+static short mccIndex[MAX_MCC + 1];
+static char mccWarned[MAX_MCC + 1];
+static char mccSelected[MAX_MCC + 1];
+static int mccSelection;
+
+void print_bin(uint64_t n)
+{
+    if (n > 1) {
+        print_bin(n >> 1);
+    }
+    printf("%lu", n & 1);
+}
+
+static int add_network(uint64_t *network, const char *str, size_t length, size_t shift, uint64_t max)
+{
+    uint64_t value;
+    if (parse_unsigned_field(str, length, &value) != 0 || value > max) {
+        return 1;
+    }
+    *network |= value << shift;
+    return 0;
+}
+
+static void add_position(uint64_t *position, const char *str, size_t length, size_t shift)
+{
+    float f = parse_decimal_field(str, length);
+    uint32_t bits;
+    // Pretend the 32b float is a 32b int, and assign the value to a 64b int.
+    memcpy(&bits, &f, sizeof(bits));
+    uint64_t t = bits;
+    t <<= shift;
+    *position |= t;
+}
+
+// Range and samples are only informative, so anything strtol() accepts will do.
+static long optional_number(const char *str, size_t length)
+{
+    uint64_t value;
+    if (parse_unsigned_field(str, length, &value) == 0) {
+        return value > LONG_MAX ? LONG_MAX : (long)value;
+    }
+    return strtol(str, NULL, 10);
+}
+
+// Only GSM, LTE and UMTS cells are encoded. Other radios (e.g. NR) have no
+// type of their own in the key, and the provider never looks them up.
+static int add_radio(uint64_t *network, const char *str, size_t length)
+{
+    if (length == 3 && memcmp(str, "GSM", 3) == 0) {
+        return 0;
+    }
+    if (length == 3 && memcmp(str, "LTE", 3) == 0) {
+        ++*network;
+        return 0;
+    }
+    if (length == 4 && memcmp(str, "UMTS", 4) == 0) {
+        *network += 2;
+        return 0;
+    }
+    return 1;
+}
+
+void init_mcc_index(void)
+{
+    size_t i;
+    for (i = 0; i <= MAX_MCC; ++i) {
+        mccIndex[i] = -1;
+    }
+    for (i = 0; mccMap[i] <= MAX_MCC; ++i) {
+        mccIndex[mccMap[i]] = i;
+    }
+}
+
+int mcc_index(long mcc)
+{
+    if (mcc <= 0 || mcc > MAX_MCC) {
+        return -1;
+    }
+    return mccIndex[mcc];
+}
+
+static int select_entry(const char *entry)
+{
+    char *end;
+    long mcc = strtol(entry, &end, 10);
+    int found = 0;
+    size_t i;
+
+    if (end != entry && *end == '\0') {
+        if (mcc_index(mcc) < 0) {
+            fprintf(stderr, "ERROR: mcc %s is not mapped\n", entry);
+            return 1;
+        }
+        mccSelected[mcc] = 1;
+        return 0;
+    }
+    for (i = 0; mccCountries[i].mcc != 0; ++i) {
+        if (strcasecmp(mccCountries[i].country, entry) == 0 && mcc_index(mccCountries[i].mcc) >= 0) {
+            mccSelected[mccCountries[i].mcc] = 1;
+            found = 1;
+        }
+    }
+    if (!found) {
+        fprintf(stderr, "ERROR: Can't find any country with code %s\n", entry);
+        return 1;
+    }
+    return 0;
+}
+
+int select_mccs(const char *list)
+{
+    char entry[16];
+    const char *start = list, *end;
+    size_t length, i;
+    int error = 0;
+
+    do {
+        end = strchr(start, ',');
+        if (end == NULL) {
+            end = start + strlen(start);
+        }
+        while (start < end && isspace((unsigned char)*start)) {
+            ++start;
+        }
+        length = end - start;
+        while (length > 0 && isspace((unsigned char)start[length - 1])) {
+            --length;
+        }
+        if (length >= sizeof(entry)) {
+            fprintf(stderr, "ERROR: Invalid country code or mcc %.*s\n", (int)length, start);
+            error = 1;
+        } else if (length > 0) {
+            memcpy(entry, start, length);
+            entry[length] = '\0';
+            error |= select_entry(entry);
+        }
+        start = end + 1;
+    } while (*end != '\0');
+
+    if (!error) {
+        fprintf(stderr, "Will encode the mlsdb data for the mccs:");
+        for (i = 0; mccMap[i] <= MAX_MCC; ++i) {
+            if (mccSelected[mccMap[i]]) {
+                fprintf(stderr, " %d", mccMap[i]);
+            }
+        }
+        fprintf(stderr, "\n");
+    }
+    mccSelection = 1;
+    return error;
+}
+
+int mcc_selection_active(void)
+{
+    return mccSelection;
+}
+
+int mcc_selected(long mcc)
+{
+    return mcc > 0 && mcc <= MAX_MCC && mccSelected[mcc];
+}
+
+enum parse_result parse_line(const char *line, size_t length, struct mlsdb_record *record)
+{
+    uint64_t network = 0, position = 0, mcc_value;
+    size_t commas[PARSED_FIELDS];
+    size_t count;
+    long mcc_num;
+    int index;
+
+    // Only the fields up to samples are needed, so the rest of the line is
+    // never even looked at.
+    count = find_commas(line, length, commas, PARSED_FIELDS);
+    mcc_num = count >= 2 && parse_unsigned_field(FIELD(1), FIELD_LENGTH(1), &mcc_value) == 0 &&
+              mcc_value <= MAX_MCC ? (long)mcc_value : 0;
+    if (mccSelection && count >= 2) {
+        // Reject unselected lines before looking at the rest of them.
+        if (commas[0] == 5 && memcmp(line, "radio", 5) == 0) {
+            return PARSE_HEADER;
+        }
+        if (mcc_num <= 0 || !mccSelected[mcc_num]) {
+            return PARSE_UNSELECTED;
+        }
+    }
+    if (count < 7) {
+        fprintf(stderr, "WARNING: Skipping malformed line starting with \"%.*s\"\n",
+                (int)(count > 0 ? commas[0] : length), line);
+        return PARSE_SKIPPED;
+    }
+    if (commas[0] == 5 && memcmp(line, "radio", 5) == 0) {
+        return PARSE_HEADER;
+    }
+
+    index = mcc_index(mcc_num);
+    if (index < 0) {
+        if (mcc_num > 0 && mcc_num <= MAX_MCC && !__atomic_exchange_n(&mccWarned[mcc_num], 1, __ATOMIC_RELAXED)) {
+            fprintf(stderr, "WARNING: Skipping records with mcc %ld, which is not mapped\n", mcc_num);
+        }
+        return PARSE_SKIPPED;
+    }
+
+    if (add_network(&network, FIELD(2), FIELD_LENGTH(2), 46, MAX_NET) != 0 ||
+        add_network(&network, FIELD(3), FIELD_LENGTH(3), 30, MAX_AREA) != 0 ||
+        add_network(&network, FIELD(4), FIELD_LENGTH(4), 2, MAX_CELL) != 0) {
+        // The value would overflow into the neighbouring bits.
+        return PARSE_SKIPPED;
+    }
+    if (add_radio(&network, line, commas[0]) != 0) {
+        return PARSE_SKIPPED;
+    }
+    record->key = ((uint64_t)index << MCC_INDEX_SHIFT) | network;
+
+    if (FIELD_LENGTH(6) == 0 && FIELD_LENGTH(7) == 0) {
+        record->position = 0;
+        record->meta = 0;
+        return PARSE_REMOVAL;
+    }
+    add_position(&position, FIELD(6), FIELD_LENGTH(6), 32);
+    add_position(&position, FIELD(7), FIELD_LENGTH(7), 0);
+    record->position = position;
+    // Older exports without these columns simply get no metadata.
+    record->meta = (count >= 8 ? mlsdbEncodeRange(optional_number(FIELD(8), FIELD_LENGTH(8))) : 0) |
+                   (count >= 9 ? mlsdbEncodeSamples(optional_number(FIELD(9), FIELD_LENGTH(9))) << 8 : 0);
+    return PARSE_RECORD;
+}
@@ -0,0 +1,55 @@
+/*
+  Copyright (C) 2022 Jolla Ltd.
+  Contact: Daniel Suni <daniel.suni@jolla.com>
+
+  This file is part of geoclue-mlsdb.
+
+  Geoclue-mlsdb is free software; you can redistribute it and/or
+  modify it under the terms of the GNU Lesser General Public
+  License as published by the Free Software Foundation; either
+  version 2.1 of the License.
+*/
+
+#ifndef GEOCLUE_MLSDB_TOOL_PARSER_H
+#define GEOCLUE_MLSDB_TOOL_PARSER_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "record.h"
+
+#define MAX_MCC 1023
+#define MAX_NET 1023
+#define MAX_AREA 65534
+#define MAX_CELL 268435455
+
+enum parse_result {
+    PARSE_SKIPPED = 0, // Malformed line, unmapped mcc, unsupported radio or out of range values.
+    PARSE_RECORD,      // A record was produced.
+    PARSE_REMOVAL,     // Only the key was produced; the line has no coordinates.
+    PARSE_HEADER,      // The CSV header line.
+    PARSE_UNSELECTED   // The mcc was not selected with select_mccs().
+};
+
+// Helper function for debugging (prints out a 64b int as binary)
+void print_bin(uint64_t n);
+
+// Must be called before parse_line().
+void init_mcc_index(void);
+int mcc_index(long mcc);
+
+// Restricts parsing to the mccs in a comma separated list of country codes
+// (e.g. "FI,IN") and/or mcc numbers. Lines for other mccs are rejected
+// right after the mcc field. Without a selection all mapped mccs are parsed.
+// Must be called after init_mcc_index(). Returns non-zero for unknown entries.
+int select_mccs(const char *list);
+// Whether select_mccs() has been called, and whether it selected the mcc.
+int mcc_selection_active(void);
+int mcc_selected(long mcc);
+
+// Parses one line of MLS CSV data into a record. The line is not modified,
+// but it must be terminated (by a NUL or a newline) at line[length]. Safe
+// to call from several threads at once.
+enum parse_result parse_line(const char *line, size_t length, struct mlsdb_record *record);
+
+#endif // GEOCLUE_MLSDB_TOOL_PARSER_H
@@ -5,9 +5,8 @@
 #define DATA_SIZE 8 // 64 bits / 8 bits to the byte
 
 // This program isn't part of the geoclue-mlsdb -suite per se. It's only
-// for testing that the files produced by geoclue-mlsdb-tool can be properly
-// read. If you want to use the "testall.sh" -script you need to compile this
-// file to a binary named "reader".
+// for looking up single cells in the files produced by geoclue-mlsdb-tool.
+// To check whole files against the CSV data, use "geoclue-mlsdb-tool -v".
 
 void print_bin(uint64_t n) {
     if (n > 1) {
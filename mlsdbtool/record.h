@@ -0,0 +1,74 @@
+/*
+  Copyright (C) 2022 Jolla Ltd.
+  Contact: Daniel Suni <daniel.suni@jolla.com>
+
+  This file is part of geoclue-mlsdb.
+
+  Geoclue-mlsdb is free software; you can redistribute it and/or
+  modify it under the terms of the GNU Lesser General Public
+  License as published by the Free Software Foundation; either
+  version 2.1 of the License.
+*/
+
+#ifndef GEOCLUE_MLSDB_TOOL_RECORD_H
+#define GEOCLUE_MLSDB_TOOL_RECORD_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#define MCC_INDEX_SHIFT 56
+#define NETWORK_MASK 0xFFFFFFFFFFFFFFULL
+#define MAX_MCC_INDEX 256
+
+// Defined in mccmapping.h, which is included by parser.c only.
+extern short mccMap[];
+
+/*
+A single cell as it is kept by the tool while building data files.
+
+The key is the same as the unique cell id used by the provider: the index
+of the mcc in mccMap in the top 8 bits, followed by the 56 bit "network"
+(see main.c). Sorting records by key therefore sorts them by mcc first, and
+then in the order they need to be in inside the mcc's .dat file. Only the
+lower 56 bits of the key are written into the file.
+
+The meta field holds the quantized range in the low byte and the quantized
+sample count in the high byte (see mlsdbcellmeta.h). It is written into the
+separate .meta file.
+*/
+struct mlsdb_record {
+    uint64_t key;
+    uint64_t position;
+    uint16_t meta;
+};
+
+// Orders records with equal keys, so that the output is deterministic.
+static inline int record_payload_less(const struct mlsdb_record *a, const struct mlsdb_record *b)
+{
+    if (a->position != b->position) {
+        return a->position < b->position;
+    }
+    return a->meta < b->meta;
+}
+
+static inline unsigned record_mcc_index(const struct mlsdb_record *record)
+{
+    return (unsigned)(record->key >> MCC_INDEX_SHIFT);
+}
+
+// Returns the index of the first of the sorted .dat keys which is >= target.
+static inline size_t record_lower_bound(const uint64_t *keys, size_t count, uint64_t target)
+{
+    size_t low = 0, high = count;
+    while (low < high) {
+        size_t mid = low + (high - low) / 2;
+        if (keys[mid] < target) {
+            low = mid + 1;
+        } else {
+            high = mid;
+        }
+    }
+    return low;
+}
+
+#endif // GEOCLUE_MLSDB_TOOL_RECORD_H
@@ -0,0 +1,380 @@
+/*
+  Copyright (C) 2022 Jolla Ltd.
+  Contact: Daniel Suni <daniel.suni@jolla.com>
+
+  This file is part of geoclue-mlsdb.
+
+  Geoclue-mlsdb is free software; you can redistribute it and/or
+  modify it under the terms of the GNU Lesser General Public
+  License as published by the Free Software Foundation; either
+  version 2.1 of the License.
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+
+#include "recordsort.h"
+
+#define INITIAL_SORTER_CAPACITY 65536
+#define MIN_RUN_BUFFER_RECORDS 4096
+#define MAX_RUN_BUFFER_RECORDS 65536 // 1 MiB per run while merging
+
+struct record_run {
+    int fd;
+    size_t count;
+    size_t consumed;
+    struct mlsdb_record *buffer;
+    size_t buffered;
+    size_t position;
+};
+
+struct mlsdb_record *radix_sort_records(struct mlsdb_record *records, struct mlsdb_record *scratch, size_t count)
+{
+    size_t histograms[8][256];
+    struct mlsdb_record *src = records, *dst = scratch, *tmp;
+    size_t i, b;
+
+    if (count < 2) {
+        return records;
+    }
+    memset(histograms, 0, sizeof(histograms));
+    for (i = 0; i < count; ++i) {
+        uint64_t key = records[i].key;
+        for (b = 0; b < 8; ++b) {
+            ++histograms[b][(key >> (8 * b)) & 0xFF];
+        }
+    }
+    // Least significant byte first; every pass is stable.
+    for (b = 0; b < 8; ++b) {
+        size_t *histogram = histograms[b];
+        size_t offset = 0, n;
+        unsigned shift = 8 * b;
+        if (histogram[(src[0].key >> shift) & 0xFF] == count) {
+            // All keys share this byte (e.g. a single mcc), nothing to do.
+            continue;
+        }
+        for (i = 0; i < 256; ++i) {
+            n = histogram[i];
+            histogram[i] = offset;
+            offset += n;
+        }
+        for (i = 0; i < count; ++i) {
+            dst[histogram[(src[i].key >> shift) & 0xFF]++] = src[i];
+        }
+        tmp = src;
+        src = dst;
+        dst = tmp;
+    }
+    // Duplicate keys are rare, so a simple insertion sort is enough to put
+    // them into a deterministic order.
+    for (i = 1; i < count; ++i) {
+        if (src[i].key == src[i - 1].key && record_payload_less(&src[i], &src[i - 1])) {
+            struct mlsdb_record record = src[i];
+            size_t j = i;
+            while (j > 0 && src[j - 1].key == record.key && record_payload_less(&record, &src[j - 1])) {
+                src[j] = src[j - 1];
+                --j;
+            }
+            src[j] = record;
+        }
+    }
+    return src;
+}
+
+static int write_all(int fd, const void *data, size_t size)
+{
+    const char *p = data;
+    while (size > 0) {
+        ssize_t written = write(fd, p, size);
+        if (written < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            return -1;
+        }
+        p += written;
+        size -= written;
+    }
+    return 0;
+}
+
+int record_sorter_init(struct record_sorter *sorter, size_t memory_budget, const char *tmp_dir)
+{
+    memset(sorter, 0, sizeof(*sorter));
+    // Sorting needs a scratch area as large as the data itself.
+    sorter->max_records = memory_budget / (2 * sizeof(struct mlsdb_record));
+    if (sorter->max_records < INITIAL_SORTER_CAPACITY) {
+        sorter->max_records = INITIAL_SORTER_CAPACITY;
+    }
+    sorter->spill_when_full = 1;
+    sorter->tmp_dir = tmp_dir;
+    return 0;
+}
+
+// Sorts the records collected so far and moves them into a new run file.
+int record_sorter_spill(struct record_sorter *sorter)
+{
+    char path[4096];
+    struct mlsdb_record *scratch, *sorted;
+    struct record_run *runs, *run;
+    int fd;
+
+    if (sorter->count == 0) {
+        return 0;
+    }
+    scratch = malloc(sorter->count * sizeof(struct mlsdb_record));
+    if (scratch == NULL) {
+        fprintf(stderr, "ERROR: Out of memory while sorting %zu records\n", sorter->count);
+        return 1;
+    }
+    sorted = radix_sort_records(sorter->records, scratch, sorter->count);
+
+    if (snprintf(path, sizeof(path), "%s/mlsdb-run-XXXXXX", sorter->tmp_dir) >= (int)sizeof(path)) {
+        fprintf(stderr, "ERROR: Temporary directory name %s is too long\n", sorter->tmp_dir);
+        free(scratch);
+        return 1;
+    }
+    fd = mkstemp(path);
+    if (fd < 0) {
+        fprintf(stderr, "ERROR: Unable to create temporary file %s: %s\n", path, strerror(errno));
+        free(scratch);
+        return 1;
+    }
+    // The file is only ever accessed through the descriptor.
+    unlink(path);
+    if (write_all(fd, sorted, sorter->count * sizeof(struct mlsdb_record)) != 0) {
+        fprintf(stderr, "ERROR: Unable to write temporary sort data: %s\n", strerror(errno));
+        free(scratch);
+        close(fd);
+        return 1;
+    }
+    free(scratch);
+
+    runs = realloc(sorter->runs, (sorter->run_count + 1) * sizeof(struct record_run));
+    if (runs == NULL) {
+        fprintf(stderr, "ERROR: Out of memory while sorting\n");
+        close(fd);
+        return 1;
+    }
+    sorter->runs = runs;
+    run = &sorter->runs[sorter->run_count++];
+    memset(run, 0, sizeof(*run));
+    run->fd = fd;
+    run->count = sorter->count;
+    sorter->count = 0;
+    return 0;
+}
+
+static int record_sorter_grow(struct record_sorter *sorter, size_t needed)
+{
+    size_t capacity = sorter->capacity ? sorter->capacity : INITIAL_SORTER_CAPACITY;
+    struct mlsdb_record *records;
+    while (capacity < needed) {
+        capacity *= 2;
+    }
+    if (sorter->spill_when_full && capacity > sorter->max_records) {
+        capacity = sorter->max_records;
+    }
+    records = realloc(sorter->records, capacity * sizeof(struct mlsdb_record));
+    if (records == NULL) {
+        fprintf(stderr, "ERROR: Out of memory while collecting %zu records\n", capacity);
+        return 1;
+    }
+    sorter->records = records;
+    sorter->capacity = capacity;
+    return 0;
+}
+
+int record_sorter_add(struct record_sorter *sorter, const struct mlsdb_record *record)
+{
+    if (sorter->count == sorter->capacity) {
+        if (sorter->spill_when_full && sorter->capacity >= sorter->max_records) {
+            if (record_sorter_spill(sorter) != 0) {
+                return 1;
+            }
+        } else if (record_sorter_grow(sorter, sorter->count + 1) != 0) {
+            return 1;
+        }
+    }
+    sorter->records[sorter->count++] = *record;
+    return 0;
+}
+
+// Only for sorters that don't spill by themselves.
+int record_sorter_add_many(struct record_sorter *sorter, const struct mlsdb_record *records, size_t count)
+{
+    if (sorter->count + count > sorter->capacity &&
+        record_sorter_grow(sorter, sorter->count + count) != 0) {
+        return 1;
+    }
+    memcpy(&sorter->records[sorter->count], records, count * sizeof(struct mlsdb_record));
+    sorter->count += count;
+    return 0;
+}
+
+// Returns the current record of the run, refilling its buffer if needed.
+// Returns NULL once the run is exhausted or on error (*error is set).
+static const struct mlsdb_record *run_peek(struct record_run *run, size_t buffer_records, int *error)
+{
+    if (run->position == run->buffered) {
+        size_t remaining = run->count - run->consumed;
+        size_t wanted = remaining < buffer_records ? remaining : buffer_records;
+        size_t size = wanted * sizeof(struct mlsdb_record);
+        size_t done = 0;
+        if (wanted == 0) {
+            return NULL;
+        }
+        while (done < size) {
+            ssize_t bytes = pread(run->fd, (char *)run->buffer + done, size - done,
+                                  run->consumed * sizeof(struct mlsdb_record) + done);
+            if (bytes < 0 && errno == EINTR) {
+                continue;
+            }
+            if (bytes <= 0) {
+                fprintf(stderr, "ERROR: Unable to read temporary sort data: %s\n",
+                        bytes < 0 ? strerror(errno) : "unexpected end of file");
+                *error = 1;
+                return NULL;
+            }
+            done += bytes;
+        }
+        run->consumed += wanted;
+        run->buffered = wanted;
+        run->position = 0;
+    }
+    return &run->buffer[run->position];
+}
+
+static int run_less(struct record_run *runs, size_t a, size_t b)
+{
+    const struct mlsdb_record *ra = &runs[a].buffer[runs[a].position];
+    const struct mlsdb_record *rb = &runs[b].buffer[runs[b].position];
+    if (ra->key != rb->key) {
+        return ra->key < rb->key;
+    }
+    if (ra->position != rb->position || ra->meta != rb->meta) {
+        return record_payload_less(ra, rb);
+    }
+    return a < b;
+}
+
+static void heap_sift_down(size_t *heap, size_t size, size_t i, struct record_run *runs)
+{
+    for (;;) {
+        size_t smallest = i, l = 2 * i + 1, r = 2 * i + 2, tmp;
+        if (l < size && run_less(runs, heap[l], heap[smallest])) {
+            smallest = l;
+        }
+        if (r < size && run_less(runs, heap[r], heap[smallest])) {
+            smallest = r;
+        }
+        if (smallest == i) {
+            return;
+        }
+        tmp = heap[i];
+        heap[i] = heap[smallest];
+        heap[smallest] = tmp;
+        i = smallest;
+    }
+}
+
+static int record_sorter_merge(struct record_sorter *sorter, record_emit_fn emit, void *context)
+{
+    size_t buffer_records = sorter->max_records * 2 / sorter->run_count;
+    size_t *heap, size = 0, i;
+    int error = 0;
+
+    if (buffer_records > MAX_RUN_BUFFER_RECORDS) {
+        buffer_records = MAX_RUN_BUFFER_RECORDS;
+    } else if (buffer_records < MIN_RUN_BUFFER_RECORDS) {
+        buffer_records = MIN_RUN_BUFFER_RECORDS;
+    }
+    heap = malloc(sorter->run_count * sizeof(size_t));
+    if (heap == NULL) {
+        fprintf(stderr, "ERROR: Out of memory while merging\n");
+        return 1;
+    }
+    for (i = 0; i < sorter->run_count; ++i) {
+        struct record_run *run = &sorter->runs[i];
+        run->buffer = malloc(buffer_records * sizeof(struct mlsdb_record));
+        if (run->buffer == NULL) {
+            fprintf(stderr, "ERROR: Out of memory while merging\n");
+            free(heap);
+            return 1;
+        }
+        if (run_peek(run, buffer_records, &error) != NULL) {
+            heap[size++] = i;
+        } else if (error) {
+            free(heap);
+            return 1;
+        }
+    }
+    for (i = size; i > 0; --i) {
+        heap_sift_down(heap, size, i - 1, sorter->runs);
+    }
+    while (size > 0) {
+        struct record_run *run = &sorter->runs[heap[0]];
+        if (emit(&run->buffer[run->position], context) != 0) {
+            free(heap);
+            return 1;
+        }
+        ++run->position;
+        if (run_peek(run, buffer_records, &error) == NULL) {
+            if (error) {
+                free(heap);
+                return 1;
+            }
+            heap[0] = heap[--size];
+        }
+        heap_sift_down(heap, size, 0, sorter->runs);
+    }
+    free(heap);
+    return 0;
+}
+
+int record_sorter_finish(struct record_sorter *sorter, record_emit_fn emit, void *context)
+{
+    struct mlsdb_record *scratch, *sorted;
+    size_t i;
+
+    if (sorter->run_count > 0) {
+        // Bounded memory: move the rest into a run too, and merge.
+        if (sorter->count > 0 && record_sorter_spill(sorter) != 0) {
+            return 1;
+        }
+        free(sorter->records);
+        sorter->records = NULL;
+        sorter->capacity = 0;
+        return record_sorter_merge(sorter, emit, context);
+    }
+
+    scratch = malloc((sorter->count ? sorter->count : 1) * sizeof(struct mlsdb_record));
+    if (scratch == NULL) {
+        fprintf(stderr, "ERROR: Out of memory while sorting %zu records\n", sorter->count);
+        return 1;
+    }
+    sorted = radix_sort_records(sorter->records, scratch, sorter->count);
+    for (i = 0; i < sorter->count; ++i) {
+        if (emit(&sorted[i], context) != 0) {
+            free(scratch);
+            return 1;
+        }
+    }
+    free(scratch);
+    return 0;
+}
+
+void record_sorter_free(struct record_sorter *sorter)
+{
+    size_t i;
+    for (i = 0; i < sorter->run_count; ++i) {
+        close(sorter->runs[i].fd);
+        free(sorter->runs[i].buffer);
+    }
+    free(sorter->runs);
+    free(sorter->records);
+    memset(sorter, 0, sizeof(*sorter));
+}
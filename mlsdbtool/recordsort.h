@@ -0,0 +1,61 @@
+/*
+  Copyright (C) 2022 Jolla Ltd.
+  Contact: Daniel Suni <daniel.suni@jolla.com>
+
+  This file is part of geoclue-mlsdb.
+
+  Geoclue-mlsdb is free software; you can redistribute it and/or
+  modify it under the terms of the GNU Lesser General Public
+  License as published by the Free Software Foundation; either
+  version 2.1 of the License.
+*/
+
+#ifndef GEOCLUE_MLSDB_TOOL_RECORDSORT_H
+#define GEOCLUE_MLSDB_TOOL_RECORDSORT_H
+
+#include <stddef.h>
+
+#include "record.h"
+
+/*
+The record sorter collects records in memory until the memory budget is
+exhausted. The collected records are then radix sorted and written into a
+temporary run file, and collection starts over. When all the input has been
+added, the runs (and whatever is still in memory) are merged, and the records
+are passed to the emit callback in key order. Records with equal keys are
+ordered by position, so the result does not depend on the order in which the
+records were added.
+
+If everything fits into the budget, no temporary files are used at all.
+A sorter whose spill_when_full is cleared only spills when asked to with
+record_sorter_spill(); the memory budget then only sizes the merge buffers.
+*/
+
+struct record_run;
+
+typedef int (*record_emit_fn)(const struct mlsdb_record *record, void *context);
+
+struct record_sorter {
+    struct mlsdb_record *records;
+    size_t count;
+    size_t capacity;
+    size_t max_records;
+    int spill_when_full;
+    struct record_run *runs;
+    size_t run_count;
+    const char *tmp_dir;
+};
+
+// Sorts count records by key (and equal keys by position) using scratch (of
+// at least count records) as temporary storage. Returns a pointer to the
+// sorted data, which is either records or scratch.
+struct mlsdb_record *radix_sort_records(struct mlsdb_record *records, struct mlsdb_record *scratch, size_t count);
+
+int record_sorter_init(struct record_sorter *sorter, size_t memory_budget, const char *tmp_dir);
+int record_sorter_add(struct record_sorter *sorter, const struct mlsdb_record *record);
+int record_sorter_add_many(struct record_sorter *sorter, const struct mlsdb_record *records, size_t count);
+int record_sorter_spill(struct record_sorter *sorter);
+int record_sorter_finish(struct record_sorter *sorter, record_emit_fn emit, void *context);
+void record_sorter_free(struct record_sorter *sorter);
+
+#endif // GEOCLUE_MLSDB_TOOL_RECORDSORT_H
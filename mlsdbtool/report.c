@@ -0,0 +1,254 @@
+/*
+  Copyright (C) 2022 Jolla Ltd.
+  Contact: Daniel Suni <daniel.suni@jolla.com>
+
+  This file is part of geoclue-mlsdb.
+
+  Geoclue-mlsdb is free software; you can redistribute it and/or
+  modify it under the terms of the GNU Lesser General Public
+  License as published by the Free Software Foundation; either
+  version 2.1 of the License.
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "report.h"
+#include "parser.h"
+#include "mlsdbcellmeta.h"
+
+#define DATA_SIZE 8        // Same as in the provider.
+#define GAP_BUCKETS 65
+#define MAX_PROBES 128
+
+static const char *radioNames[] = {"GSM", "LTE", "UMTS", "other"};
+
+struct lookup_cost {
+    size_t total_depth;
+    size_t max_depth;
+    size_t total_pages;
+    size_t max_pages;
+    size_t unreachable;
+};
+
+static size_t count_page(size_t *pages, size_t count, size_t page)
+{
+    size_t i;
+    for (i = 0; i < count; ++i) {
+        if (pages[i] == page) {
+            return count;
+        }
+    }
+    if (count < MAX_PROBES) {
+        pages[count++] = page;
+    }
+    return count;
+}
+
+// The lookup of MlsdbCellLocator::searchForCellIdLocation(): std::lower_bound()
+// over the mapped network section (as implemented by libstdc++), then the
+// position in the location section, and the metadata in the .meta file.
+// Records the pages it touches.
+static void provider_search(const uint64_t *keys, size_t count, size_t filesize, uint64_t uid, int has_meta,
+                            struct lookup_cost *cost)
+{
+    size_t pages[MAX_PROBES];
+    size_t page_count = 0, depth = 0;
+    size_t first = 0, len = count;
+
+    while (len > 0) {
+        size_t half = len / 2;
+        size_t middle = first + half;
+        page_count = count_page(pages, page_count, middle * DATA_SIZE / REPORT_PAGE_SIZE);
+        ++depth;
+        if (keys[middle] < uid) {
+            first = middle + 1;
+            len -= half + 1;
+        } else {
+            len = half;
+        }
+    }
+    if (first == count || keys[first] != uid) {
+        // Only possible if the keys are out of order.
+        ++cost->unreachable;
+        return;
+    }
+    page_count = count_page(pages, page_count, first * DATA_SIZE / REPORT_PAGE_SIZE);
+    page_count = count_page(pages, page_count, (filesize / 2 + first * DATA_SIZE) / REPORT_PAGE_SIZE);
+    page_count += has_meta != 0;
+    cost->total_depth += depth;
+    cost->total_pages += page_count;
+    if (depth > cost->max_depth) {
+        cost->max_depth = depth;
+    }
+    if (page_count > cost->max_pages) {
+        cost->max_pages = page_count;
+    }
+}
+
+static size_t ceil_log2(size_t n)
+{
+    size_t bits = 0;
+    while (((size_t)1 << bits) < n) {
+        ++bits;
+    }
+    return bits;
+}
+
+static void print_cost(FILE *out, const char *name, const struct lookup_cost *cost, size_t lookups,
+                       const char *extra)
+{
+    size_t found = lookups - cost->unreachable;
+    fprintf(out, "    \"%s\": {\"expected_depth\": %.2f, \"max_depth\": %zu, "
+                 "\"expected_pages\": %.2f, \"max_pages\": %zu, \"unreachable\": %zu%s}",
+            name, found ? (double)cost->total_depth / found : 0.0, cost->max_depth,
+            found ? (double)cost->total_pages / found : 0.0, cost->max_pages, cost->unreachable, extra);
+}
+
+static int write_json(FILE *out, unsigned mcc, const uint64_t *keys, size_t count, size_t filesize, int has_meta)
+{
+    size_t radios[4] = {0, 0, 0, 0};
+    size_t gaps[GAP_BUCKETS];
+    size_t *networks, *network_areas;
+    size_t areas = 0, duplicates = 0, i, last_bucket = 0;
+    size_t extra_pages = 1 + (has_meta != 0);
+    size_t keys_per_page = REPORT_PAGE_SIZE / DATA_SIZE;
+    size_t index_entries = (count + keys_per_page - 1) / keys_per_page;
+    struct lookup_cost search, indexed;
+    char extra[128];
+    int first;
+
+    networks = calloc(MAX_NET + 1, sizeof(size_t));
+    network_areas = calloc(MAX_NET + 1, sizeof(size_t));
+    if (networks == NULL || network_areas == NULL) {
+        free(networks);
+        free(network_areas);
+        fprintf(stderr, "ERROR: Out of memory while writing the report for mcc %u\n", mcc);
+        return 1;
+    }
+    memset(gaps, 0, sizeof(gaps));
+    memset(&search, 0, sizeof(search));
+    memset(&indexed, 0, sizeof(indexed));
+
+    for (i = 0; i < count; ++i) {
+        unsigned net = (keys[i] >> 46) & 0x3FF;
+        ++radios[keys[i] & 3];
+        ++networks[net];
+        // The keys are sorted by network and area first, so a new area shows
+        // up as a change in the bits above the cell id.
+        if (i == 0 || (keys[i] >> 30) != (keys[i - 1] >> 30)) {
+            ++areas;
+            ++network_areas[net];
+        }
+        if (i > 0) {
+            uint64_t gap = keys[i] - keys[i - 1];
+            size_t bucket = gap ? 64 - __builtin_clzll(gap) : 0;
+            if (keys[i] < keys[i - 1]) {
+                bucket = GAP_BUCKETS - 1; // Out of order, also caught by verify.
+            }
+            duplicates += gap == 0;
+            ++gaps[bucket];
+            if (bucket > last_bucket) {
+                last_bucket = bucket;
+            }
+        }
+        provider_search(keys, count, filesize, keys[i], has_meta, &search);
+    }
+    // With a page index the search within memory takes log2(pages) steps,
+    // and the search within the page log2(keys per page) steps.
+    indexed.total_depth = count * (ceil_log2(index_entries) + ceil_log2(count < keys_per_page ? count : keys_per_page));
+    indexed.max_depth = count ? indexed.total_depth / count : 0;
+    indexed.total_pages = count * (1 + extra_pages);
+    indexed.max_pages = count ? 1 + extra_pages : 0;
+
+    fprintf(out, "{\n  \"mcc\": %u,\n  \"records\": %zu,\n  \"dat_size\": %zu,\n  \"meta_size\": %zu,\n",
+            mcc, count, filesize, has_meta ? count * MLSDB_META_SIZE : 0);
+    fprintf(out, "  \"radios\": {");
+    for (i = 0; i < 4; ++i) {
+        fprintf(out, "%s\"%s\": %zu", i ? ", " : "", radioNames[i], radios[i]);
+    }
+    fprintf(out, "},\n  \"networks\": {");
+    for (i = 0, first = 1; i <= MAX_NET; ++i) {
+        if (networks[i]) {
+            fprintf(out, "%s\"%zu\": {\"records\": %zu, \"areas\": %zu}", first ? "" : ", ",
+                    i, networks[i], network_areas[i]);
+            first = 0;
+        }
+    }
+    fprintf(out, "},\n  \"areas\": %zu,\n  \"duplicate_keys\": %zu,\n  \"key_gap_log2_histogram\": [", areas, duplicates);
+    for (i = 0; i <= last_bucket && count > 1; ++i) {
+        fprintf(out, "%s%zu", i ? ", " : "", gaps[i]);
+    }
+    fprintf(out, "],\n  \"lookup\": {\n");
+    print_cost(out, "binary_search", &search, count, "");
+    fprintf(out, ",\n");
+    snprintf(extra, sizeof(extra), ", \"index_bytes\": %zu", index_entries * DATA_SIZE);
+    print_cost(out, "page_index", &indexed, count, extra);
+    fprintf(out, "\n  }\n}\n");
+
+    free(networks);
+    free(network_areas);
+    return 0;
+}
+
+int write_report(const char *dir, unsigned mcc)
+{
+    char path[4096], tmp_path[4096];
+    struct stat st;
+    void *map;
+    FILE *out;
+    int fd, has_meta, error;
+
+    if (snprintf(path, sizeof(path), "%s/%u.meta", dir, mcc) >= (int)sizeof(path)) {
+        fprintf(stderr, "ERROR: Output directory name %s is too long\n", dir);
+        return 1;
+    }
+    has_meta = access(path, R_OK) == 0;
+    snprintf(path, sizeof(path), "%s/%u.dat", dir, mcc);
+    fd = open(path, O_RDONLY);
+    if (fd < 0) {
+        fprintf(stderr, "ERROR: Unable to open %s: %s\n", path, strerror(errno));
+        return 1;
+    }
+    if (fstat(fd, &st) != 0 || st.st_size == 0 || st.st_size % (2 * DATA_SIZE) != 0) {
+        fprintf(stderr, "ERROR: File size of %s is not a multiple of data size. Corrupt file?\n", path);
+        close(fd);
+        return 1;
+    }
+    map = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (map == MAP_FAILED) {
+        fprintf(stderr, "ERROR: Unable to map %s: %s\n", path, strerror(errno));
+        return 1;
+    }
+
+    snprintf(path, sizeof(path), "%s/%u.report.json", dir, mcc);
+    snprintf(tmp_path, sizeof(tmp_path), "%s/%u.report.json.tmp", dir, mcc);
+    out = fopen(tmp_path, "w");
+    if (out == NULL) {
+        fprintf(stderr, "ERROR: Unable to open %s: %s\n", tmp_path, strerror(errno));
+        munmap(map, st.st_size);
+        return 1;
+    }
+    error = write_json(out, mcc, map, st.st_size / (2 * DATA_SIZE), st.st_size, has_meta);
+    munmap(map, st.st_size);
+    if (fclose(out) != 0 && !error) {
+        fprintf(stderr, "ERROR: Unable to write %s: %s\n", tmp_path, strerror(errno));
+        error = 1;
+    }
+    if (!error && rename(tmp_path, path) != 0) {
+        fprintf(stderr, "ERROR: Unable to rename %s to %s: %s\n", tmp_path, path, strerror(errno));
+        error = 1;
+    }
+    if (error) {
+        unlink(tmp_path);
+    }
+    return error;
+}
@@ -0,0 +1,43 @@
+/*
+  Copyright (C) 2022 Jolla Ltd.
+  Contact: Daniel Suni <daniel.suni@jolla.com>
+
+  This file is part of geoclue-mlsdb.
+
+  Geoclue-mlsdb is free software; you can redistribute it and/or
+  modify it under the terms of the GNU Lesser General Public
+  License as published by the Free Software Foundation; either
+  version 2.1 of the License.
+*/
+
+#ifndef GEOCLUE_MLSDB_TOOL_REPORT_H
+#define GEOCLUE_MLSDB_TOOL_REPORT_H
+
+#define REPORT_PAGE_SIZE 4096 // The unit of I/O assumed for lookup costs.
+
+/*
+Writes <mcc>.report.json next to a .dat file, describing its contents and how
+expensive it is going to be to search on the device:
+ - record counts per radio type and per network (mnc),
+ - the number of distinct location areas, in total and per network,
+ - the number of duplicate keys, and a histogram of the gaps between
+   consecutive keys (bucket b counts gaps g with 2^(b-1) <= g < 2^b, bucket 0
+   counts duplicates),
+ - the expected and worst case search depth and the number of distinct
+   pages touched per lookup, for every lookup strategy:
+    - "binary_search" is what the provider does now: std::lower_bound() over
+      the memory mapped network section (found by running that search for
+      every key in the file; keys it cannot find, which only happens if the
+      file is out of order, show up in "unreachable"),
+    - "page_index" is the cost with the first key of every page of the
+      network section held in memory, and the size of that index.
+   The page counts include the page of the position, and of the metadata
+   if there is a .meta file.
+
+The reports are meant to be compared between data releases, and used to
+choose the format for a country.
+*/
+
+int write_report(const char *dir, unsigned mcc);
+
+#endif // GEOCLUE_MLSDB_TOOL_REPORT_H
@@ -0,0 +1,296 @@
+/*
+  Copyright (C) 2022 Jolla Ltd.
+  Contact: Daniel Suni <daniel.suni@jolla.com>
+
+  This file is part of geoclue-mlsdb.
+
+  Geoclue-mlsdb is free software; you can redistribute it and/or
+  modify it under the terms of the GNU Lesser General Public
+  License as published by the Free Software Foundation; either
+  version 2.1 of the License.
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "update.h"
+#include "record.h"
+#include "parser.h"
+#include "chunkreader.h"
+#include "datwriter.h"
+#include "mlsdbcellmeta.h"
+
+#define NEWLINE 10
+#define INITIAL_DIFF_CAPACITY 4096
+
+struct diff_entry {
+    uint64_t key;
+    uint64_t position;
+    uint16_t meta;
+    size_t ordinal;
+    int removal;
+};
+
+struct diff_context {
+    struct diff_entry *entries;
+    size_t count;
+    size_t capacity;
+    size_t skipped;
+};
+
+// Only ever called from a single worker thread, so the chunks arrive in
+// input order and the entry count doubles as the line ordinal.
+static int parse_diff_chunk(char *data, size_t size, size_t sequence, void *context)
+{
+    struct diff_context *ctx = context;
+    char *line = data, *end = data + size, *nl;
+    struct mlsdb_record record;
+    (void)sequence;
+
+    while ((nl = memchr(line, NEWLINE, end - line)) != NULL) {
+        enum parse_result result;
+        *nl = '\0';
+        result = nl > line ? parse_line(line, nl - line, &record) : PARSE_HEADER;
+        line = nl + 1;
+        if (result == PARSE_SKIPPED) {
+            ++ctx->skipped;
+        }
+        if (result != PARSE_RECORD && result != PARSE_REMOVAL) {
+            continue;
+        }
+        if (ctx->count == ctx->capacity) {
+            size_t capacity = ctx->capacity ? ctx->capacity * 2 : INITIAL_DIFF_CAPACITY;
+            struct diff_entry *entries = realloc(ctx->entries, capacity * sizeof(struct diff_entry));
+            if (entries == NULL) {
+                fprintf(stderr, "ERROR: Out of memory while reading the diff\n");
+                return 1;
+            }
+            ctx->entries = entries;
+            ctx->capacity = capacity;
+        }
+        ctx->entries[ctx->count].key = record.key;
+        ctx->entries[ctx->count].position = record.position;
+        ctx->entries[ctx->count].meta = record.meta;
+        ctx->entries[ctx->count].ordinal = ctx->count;
+        ctx->entries[ctx->count].removal = result == PARSE_REMOVAL;
+        ++ctx->count;
+    }
+    return 0;
+}
+
+static int compare_entries(const void *a, const void *b)
+{
+    const struct diff_entry *ea = a, *eb = b;
+    if (ea->key != eb->key) {
+        return ea->key < eb->key ? -1 : 1;
+    }
+    return ea->ordinal < eb->ordinal ? -1 : (ea->ordinal > eb->ordinal);
+}
+
+// Maps the .meta file of an mcc, if there is one with metadata for all of
+// the count records. Returns NULL otherwise, and the records then get no
+// metadata.
+static const unsigned char *map_meta(const char *dir, unsigned mcc, size_t count, size_t *map_size)
+{
+    char path[4096];
+    struct stat st;
+    void *map;
+    int fd;
+
+    if (count == 0 || snprintf(path, sizeof(path), "%s/%u.meta", dir, mcc) >= (int)sizeof(path)) {
+        return NULL;
+    }
+    fd = open(path, O_RDONLY);
+    if (fd < 0) {
+        return NULL;
+    }
+    if (fstat(fd, &st) != 0 || (size_t)st.st_size != count * MLSDB_META_SIZE) {
+        fprintf(stderr, "WARNING: Ignoring %s, which does not match its .dat file\n", path);
+        close(fd);
+        return NULL;
+    }
+    map = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (map == MAP_FAILED) {
+        return NULL;
+    }
+    madvise(map, st.st_size, MADV_SEQUENTIAL);
+    *map_size = st.st_size;
+    return map;
+}
+
+static int update_mcc(const char *dir, unsigned mcc, const struct diff_entry *entries, size_t count,
+                      struct update_stats *stats)
+{
+    char path[4096];
+    const uint64_t *keys = NULL, *positions = NULL;
+    const unsigned char *metas;
+    size_t old_count = 0, new_count, map_size = 0, meta_size = 0, i = 0, j = 0;
+    size_t inserted = 0, updated = 0, removed = 0;
+    struct dat_writer writer;
+    struct mlsdb_record record;
+    void *map = NULL;
+    int fd, error = 0, changed = 0;
+
+    if (snprintf(path, sizeof(path), "%s/%u.dat", dir, mcc) >= (int)sizeof(path)) {
+        fprintf(stderr, "ERROR: Output directory name %s is too long\n", dir);
+        return 1;
+    }
+    fd = open(path, O_RDONLY);
+    if (fd < 0 && errno == ENOENT && !mcc_selected(mcc)) {
+        // The mcc was never built here, so the diff alone would only give a
+        // partial file. It is created only when asked for with -c.
+        stats->unbuilt += count;
+        return 0;
+    }
+    if (fd < 0 && errno != ENOENT) {
+        fprintf(stderr, "ERROR: Unable to open %s: %s\n", path, strerror(errno));
+        return 1;
+    }
+    if (fd >= 0) {
+        struct stat st;
+        if (fstat(fd, &st) != 0 || st.st_size % (2 * sizeof(uint64_t)) != 0) {
+            fprintf(stderr, "ERROR: File size of %s is not a multiple of data size. Corrupt file?\n", path);
+            close(fd);
+            return 1;
+        }
+        map_size = st.st_size;
+        if (map_size > 0) {
+            map = mmap(NULL, map_size, PROT_READ, MAP_PRIVATE, fd, 0);
+            if (map == MAP_FAILED) {
+                fprintf(stderr, "ERROR: Unable to map %s: %s\n", path, strerror(errno));
+                close(fd);
+                return 1;
+            }
+            madvise(map, map_size, MADV_SEQUENTIAL);
+            old_count = map_size / (2 * sizeof(uint64_t));
+            keys = map;
+            positions = keys + old_count;
+        }
+        close(fd);
+    }
+    metas = map_meta(dir, mcc, old_count, &meta_size);
+
+    // Work out the size of the new file first, so that it can be written in
+    // a single pass.
+    new_count = old_count;
+    for (j = 0; j < count; ++j) {
+        uint64_t key = entries[j].key & NETWORK_MASK;
+        size_t first = record_lower_bound(keys, old_count, key);
+        size_t last = first;
+        while (last < old_count && keys[last] == key) {
+            ++last;
+        }
+        new_count -= last - first;
+        if (!entries[j].removal) {
+            ++new_count;
+            if (last > first) {
+                ++updated;
+            } else {
+                ++inserted;
+            }
+        } else if (last > first) {
+            ++removed;
+        }
+    }
+
+    if (new_count == 0) {
+        changed = old_count > 0;
+        if (old_count > 0 && unlink(path) != 0) {
+            fprintf(stderr, "ERROR: Unable to remove %s: %s\n", path, strerror(errno));
+            error = 1;
+        }
+        snprintf(path, sizeof(path), "%s/%u.meta", dir, mcc);
+        if (unlink(path) != 0 && errno != ENOENT) {
+            fprintf(stderr, "ERROR: Unable to remove %s: %s\n", path, strerror(errno));
+            error = 1;
+        }
+    } else if (inserted + updated + removed > 0) {
+        changed = 1;
+        if (dat_writer_open(&writer, dir, mcc, new_count) != 0) {
+            error = 1;
+        }
+        // Merge the two sorted streams.
+        for (i = 0, j = 0; !error && (i < old_count || j < count); ) {
+            uint64_t key = j < count ? entries[j].key & NETWORK_MASK : 0;
+            if (j < count && (i == old_count || key <= keys[i])) {
+                while (i < old_count && keys[i] == key) {
+                    ++i; // Replaced or removed.
+                }
+                if (!entries[j].removal) {
+                    record.key = key;
+                    record.position = entries[j].position;
+                    record.meta = entries[j].meta;
+                    error = dat_writer_add(&writer, &record);
+                }
+                ++j;
+            } else {
+                record.key = keys[i];
+                record.position = positions[i];
+                record.meta = metas ? metas[i * MLSDB_META_SIZE] | metas[i * MLSDB_META_SIZE + 1] << 8 : 0;
+                error = dat_writer_add(&writer, &record);
+                ++i;
+            }
+        }
+        if (error) {
+            dat_writer_abort(&writer);
+        } else {
+            error = dat_writer_close(&writer);
+        }
+    }
+    if (map != NULL) {
+        munmap(map, map_size);
+    }
+    if (metas != NULL) {
+        munmap((void *)metas, meta_size);
+    }
+    if (!error) {
+        stats->files += changed;
+        stats->inserted += inserted;
+        stats->updated += updated;
+        stats->removed += removed;
+    }
+    return error;
+}
+
+int update_dat_files(int fd, const char *dir, size_t *total_bytes, struct update_stats *stats)
+{
+    struct diff_context ctx;
+    void *context = &ctx;
+    size_t start, end, unique = 0, i;
+    int error = 0;
+
+    memset(&ctx, 0, sizeof(ctx));
+    memset(stats, 0, sizeof(*stats));
+    if (read_chunks(fd, 1, parse_diff_chunk, &context, total_bytes) != 0) {
+        free(ctx.entries);
+        return 1;
+    }
+    stats->skipped = ctx.skipped;
+    qsort(ctx.entries, ctx.count, sizeof(struct diff_entry), compare_entries);
+
+    // Keep only the last line for each cell.
+    for (i = 0; i < ctx.count; ++i) {
+        if (i + 1 < ctx.count && ctx.entries[i + 1].key == ctx.entries[i].key) {
+            continue;
+        }
+        ctx.entries[unique++] = ctx.entries[i];
+    }
+
+    for (start = 0; !error && start < unique; start = end) {
+        unsigned index = (unsigned)(ctx.entries[start].key >> MCC_INDEX_SHIFT);
+        end = start;
+        while (end < unique && (unsigned)(ctx.entries[end].key >> MCC_INDEX_SHIFT) == index) {
+            ++end;
+        }
+        error = update_mcc(dir, mccMap[index], &ctx.entries[start], end - start, stats);
+    }
+    free(ctx.entries);
+    return error;
+}
@@ -0,0 +1,48 @@
+/*
+  Copyright (C) 2022 Jolla Ltd.
+  Contact: Daniel Suni <daniel.suni@jolla.com>
+
+  This file is part of geoclue-mlsdb.
+
+  Geoclue-mlsdb is free software; you can redistribute it and/or
+  modify it under the terms of the GNU Lesser General Public
+  License as published by the Free Software Foundation; either
+  version 2.1 of the License.
+*/
+
+#ifndef GEOCLUE_MLSDB_TOOL_UPDATE_H
+#define GEOCLUE_MLSDB_TOOL_UPDATE_H
+
+#include <stddef.h>
+
+/*
+Updates existing .dat files with an MLS differential export instead of
+rebuilding them from a full export.
+
+The diff is read completely into memory (it is small), sorted, and then
+merged with each affected .dat file in a single sequential pass over the
+old file. For every cell in the diff:
+ - if the cell is not in the file, it is inserted,
+ - if it is, its position is replaced,
+ - if the diff line has empty lon and lat fields, the cell is removed.
+If the same cell occurs several times in the diff, the last line wins.
+A .dat file that ends up empty is removed. The .meta file is rewritten along
+with its .dat file; records which are not in the diff keep their metadata.
+
+Only the mccs which already have a .dat file are updated, as the diff has
+just the recently changed cells. A new .dat file is created from the diff
+only for an mcc which was explicitly selected with select_mccs().
+*/
+
+struct update_stats {
+    size_t files;
+    size_t inserted;
+    size_t updated;
+    size_t removed;
+    size_t skipped;
+    size_t unbuilt; // records for mccs without a .dat file, which were left alone
+};
+
+int update_dat_files(int fd, const char *dir, size_t *total_bytes, struct update_stats *stats);
+
+#endif // GEOCLUE_MLSDB_TOOL_UPDATE_H
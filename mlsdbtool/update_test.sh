@@ -0,0 +1,56 @@
+#!/bin/bash
+set -e
+
+# Checks that geoclue-mlsdb-tool -u leaves the mccs which have not been
+# built alone, and only creates their .dat files when they are selected
+# with -c, and that only the files which change are counted as updated.
+
+rundir=`cd \`dirname $0\` && pwd`
+TOOL=${TOOL:-$rundir/geoclue-mlsdb-tool}
+workdir=`mktemp -d`
+trap "rm -rf $workdir" EXIT
+
+if [ ! -x "$TOOL" ] ; then
+    echo "ERROR: Can't find executable $TOOL" >&2
+    exit 1
+fi
+
+fail() {
+    echo "FAIL: $1" >&2
+    exit 1
+}
+
+header="radio,mcc,net,area,cell,unit,lon,lat,range,samples,changeable,created,updated,averageSignal"
+cat > $workdir/full.csv <<EOF
+$header
+GSM,244,5,100,1001,,24.9384,60.1699,1000,10,1,0,0,
+LTE,244,5,100,1002,,24.9400,60.1710,500,20,1,0,0,
+EOF
+cat > $workdir/diff.csv <<EOF
+$header
+UMTS,244,5,100,1003,,24.9500,60.1800,800,5,1,0,0,
+GSM,404,10,200,2001,,77.2090,28.6139,1500,3,1,0,0,
+EOF
+
+cd $workdir
+$TOOL full.csv 2> /dev/null
+[ -e 244.dat ] || fail "244.dat was not built"
+size=`stat -c %s 244.dat`
+
+$TOOL -u diff.csv 2> /dev/null
+[ `stat -c %s 244.dat` -gt $size ] || fail "244.dat was not updated"
+[ ! -e 404.dat ] || fail "404.dat was created from the diff alone"
+[ ! -e 404.meta ] || fail "404.meta was created from the diff alone"
+
+$TOOL -u -c 404 diff.csv 2> /dev/null
+[ -e 404.dat ] || fail "404.dat was not created although selected with -c"
+[ -e 404.meta ] || fail "404.meta was not created although selected with -c"
+
+# Removing a cell which isn't there leaves the file alone.
+cat > $workdir/noop.csv <<EOF
+$header
+GSM,244,5,100,9999,,,,,,1,0,0,
+EOF
+$TOOL -u noop.csv 2>&1 | grep -q "^Updated 0 files" || fail "an unchanged file was counted as updated"
+
+echo "PASS"
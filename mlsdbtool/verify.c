@@ -0,0 +1,312 @@
+/*
+  Copyright (C) 2022 Jolla Ltd.
+  Contact: Daniel Suni <daniel.suni@jolla.com>
+
+  This file is part of geoclue-mlsdb.
+
+  Geoclue-mlsdb is free software; you can redistribute it and/or
+  modify it under the terms of the GNU Lesser General Public
+  License as published by the Free Software Foundation; either
+  version 2.1 of the License.
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "verify.h"
+#include "record.h"
+#include "parser.h"
+#include "chunkreader.h"
+#include "mlsdbcellmeta.h"
+
+#define NEWLINE 10
+
+static const char *radioNames[] = {"GSM", "LTE", "UMTS", "other"};
+
+struct verify_file {
+    void *map;
+    size_t map_size;
+    const uint64_t *keys;
+    const uint64_t *positions;
+    const unsigned char *metas; // NULL if there is no .meta file.
+    size_t meta_size;
+    size_t count;
+    unsigned char *seen; // One byte per record, so that workers can set them without locking.
+};
+
+struct verify_shared {
+    struct verify_file files[MAX_MCC_INDEX];
+    int require_files;
+    size_t reported;
+};
+
+struct verify_context {
+    struct verify_shared *shared;
+    size_t checked;
+    size_t missing;
+    size_t mismatched;
+    size_t skipped;
+};
+
+static float position_lon(uint64_t position)
+{
+    uint32_t bits = (uint32_t)(position >> 32);
+    float f;
+    memcpy(&f, &bits, sizeof(f));
+    return f;
+}
+
+static float position_lat(uint64_t position)
+{
+    uint32_t bits = (uint32_t)position;
+    float f;
+    memcpy(&f, &bits, sizeof(f));
+    return f;
+}
+
+static uint16_t file_meta(const struct verify_file *file, size_t i)
+{
+    return file->metas[i * MLSDB_META_SIZE] | file->metas[i * MLSDB_META_SIZE + 1] << 8;
+}
+
+static int positions_match(uint64_t a, uint64_t b)
+{
+    double lon = (double)position_lon(a) - position_lon(b);
+    double lat = (double)position_lat(a) - position_lat(b);
+    return a == b || (lon >= -VERIFY_TOLERANCE && lon <= VERIFY_TOLERANCE &&
+                      lat >= -VERIFY_TOLERANCE && lat <= VERIFY_TOLERANCE);
+}
+
+static void report(struct verify_shared *shared, const char *what, uint64_t key, uint64_t expected,
+                   const uint64_t *found)
+{
+    if (__atomic_fetch_add(&shared->reported, 1, __ATOMIC_RELAXED) >= VERIFY_MAX_REPORTED) {
+        return;
+    }
+    if (found) {
+        fprintf(stderr, "%s: mcc %d net %lu area %lu cell %lu %s: expected lon %f lat %f, got lon %f lat %f\n",
+                what, mccMap[key >> MCC_INDEX_SHIFT], (key >> 46) & 0x3FF, (key >> 30) & 0xFFFF,
+                (key >> 2) & 0xFFFFFFF, radioNames[key & 3], position_lon(expected), position_lat(expected),
+                position_lon(*found), position_lat(*found));
+    } else {
+        fprintf(stderr, "%s: mcc %d net %lu area %lu cell %lu %s: lon %f lat %f\n",
+                what, mccMap[key >> MCC_INDEX_SHIFT], (key >> 46) & 0x3FF, (key >> 30) & 0xFFFF,
+                (key >> 2) & 0xFFFFFFF, radioNames[key & 3], position_lon(expected), position_lat(expected));
+    }
+}
+
+static void verify_record(struct verify_context *ctx, const struct mlsdb_record *record)
+{
+    struct verify_file *file = &ctx->shared->files[record_mcc_index(record)];
+    uint64_t key = record->key & NETWORK_MASK;
+    size_t i;
+    int matched = 0;
+
+    if (file->map == NULL) {
+        if (ctx->shared->require_files) {
+            ++ctx->missing;
+            report(ctx->shared, "MISSING", record->key, record->position, NULL);
+        }
+        return;
+    }
+    ++ctx->checked;
+    i = record_lower_bound(file->keys, file->count, key);
+    if (i == file->count || file->keys[i] != key) {
+        ++ctx->missing;
+        report(ctx->shared, "MISSING", record->key, record->position, NULL);
+        return;
+    }
+    // With duplicates in the data any one of them may be the right one.
+    for (; i < file->count && file->keys[i] == key; ++i) {
+        __atomic_store_n(&file->seen[i], 1, __ATOMIC_RELAXED);
+        if (!matched && positions_match(record->position, file->positions[i])
+                && (file->metas == NULL || file_meta(file, i) == record->meta)) {
+            matched = 1;
+        }
+    }
+    if (!matched) {
+        ++ctx->mismatched;
+        report(ctx->shared, "MISMATCH", record->key, record->position, &file->positions[i - 1]);
+    }
+}
+
+static int verify_chunk(char *data, size_t size, size_t sequence, void *context)
+{
+    struct verify_context *ctx = context;
+    char *line = data, *end = data + size, *nl;
+    struct mlsdb_record record;
+    (void)sequence;
+
+    while ((nl = memchr(line, NEWLINE, end - line)) != NULL) {
+        *nl = '\0';
+        if (nl > line) {
+            enum parse_result result = parse_line(line, nl - line, &record);
+            if (result == PARSE_RECORD) {
+                verify_record(ctx, &record);
+            } else if (result == PARSE_SKIPPED) {
+                ++ctx->skipped;
+            }
+        }
+        line = nl + 1;
+    }
+    return 0;
+}
+
+static int open_file(struct verify_file *file, const char *dir, unsigned mcc, struct verify_stats *stats)
+{
+    char path[4096];
+    struct stat st;
+    size_t i;
+    int fd;
+
+    if (snprintf(path, sizeof(path), "%s/%u.dat", dir, mcc) >= (int)sizeof(path)) {
+        fprintf(stderr, "ERROR: Data directory name %s is too long\n", dir);
+        return 1;
+    }
+    fd = open(path, O_RDONLY);
+    if (fd < 0) {
+        if (errno == ENOENT) {
+            return 0;
+        }
+        fprintf(stderr, "ERROR: Unable to open %s: %s\n", path, strerror(errno));
+        return 1;
+    }
+    if (fstat(fd, &st) != 0 || st.st_size == 0 || st.st_size % (2 * sizeof(uint64_t)) != 0) {
+        fprintf(stderr, "ERROR: File size of %s is not a multiple of data size. Corrupt file?\n", path);
+        close(fd);
+        return 1;
+    }
+    file->map_size = st.st_size;
+    file->map = mmap(NULL, file->map_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (file->map == MAP_FAILED) {
+        fprintf(stderr, "ERROR: Unable to map %s: %s\n", path, strerror(errno));
+        file->map = NULL;
+        return 1;
+    }
+    madvise(file->map, file->map_size, MADV_WILLNEED);
+    file->count = file->map_size / (2 * sizeof(uint64_t));
+    file->keys = file->map;
+    file->positions = file->keys + file->count;
+    file->seen = calloc(file->count, 1);
+    if (file->seen == NULL) {
+        fprintf(stderr, "ERROR: Out of memory while verifying %s\n", path);
+        return 1;
+    }
+
+    for (i = 1; i < file->count; ++i) {
+        if (file->keys[i] < file->keys[i - 1]) {
+            if (stats->misordered++ < VERIFY_MAX_REPORTED) {
+                fprintf(stderr, "MISORDERED: %s record %zu has key %lu, which is smaller than the previous %lu\n",
+                        path, i, file->keys[i], file->keys[i - 1]);
+            }
+        } else if (file->keys[i] == file->keys[i - 1]) {
+            if (stats->duplicates++ < VERIFY_MAX_REPORTED) {
+                fprintf(stderr, "DUPLICATE: %s records %zu and %zu have the same key %lu\n",
+                        path, i - 1, i, file->keys[i]);
+            }
+        }
+    }
+    ++stats->files;
+
+    if (snprintf(path, sizeof(path), "%s/%u.meta", dir, mcc) >= (int)sizeof(path)) {
+        return 0;
+    }
+    fd = open(path, O_RDONLY);
+    if (fd < 0) {
+        return 0;
+    }
+    if (fstat(fd, &st) != 0 || (size_t)st.st_size != file->count * MLSDB_META_SIZE) {
+        fprintf(stderr, "ERROR: Size of %s does not match its .dat file\n", path);
+        close(fd);
+        return 1;
+    }
+    file->meta_size = st.st_size;
+    file->metas = mmap(NULL, file->meta_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (file->metas == MAP_FAILED) {
+        fprintf(stderr, "ERROR: Unable to map %s: %s\n", path, strerror(errno));
+        file->metas = NULL;
+        return 1;
+    }
+    return 0;
+}
+
+int verify_dat_files(int fd, const char *dir, unsigned thread_count, size_t *total_bytes,
+                     struct verify_stats *stats)
+{
+    struct verify_shared *shared;
+    struct verify_context *contexts;
+    void **context_ptrs;
+    size_t i, j;
+    int error = 0;
+
+    memset(stats, 0, sizeof(*stats));
+    shared = calloc(1, sizeof(struct verify_shared));
+    contexts = calloc(thread_count, sizeof(struct verify_context));
+    context_ptrs = calloc(thread_count, sizeof(void *));
+    if (shared == NULL || contexts == NULL || context_ptrs == NULL) {
+        fprintf(stderr, "ERROR: Out of memory\n");
+        free(shared);
+        free(contexts);
+        free(context_ptrs);
+        return 1;
+    }
+    shared->require_files = mcc_selection_active();
+
+    for (i = 0; !error && mccMap[i] <= MAX_MCC; ++i) {
+        if (!shared->require_files || mcc_selected(mccMap[i])) {
+            error = open_file(&shared->files[i], dir, mccMap[i], stats);
+        }
+    }
+    if (!error && stats->files == 0 && !shared->require_files) {
+        fprintf(stderr, "ERROR: No .dat files found in %s\n", dir);
+        error = 1;
+    }
+
+    if (!error) {
+        for (i = 0; i < thread_count; ++i) {
+            contexts[i].shared = shared;
+            context_ptrs[i] = &contexts[i];
+        }
+        error = read_chunks(fd, thread_count, verify_chunk, context_ptrs, total_bytes);
+        for (i = 0; i < thread_count; ++i) {
+            stats->checked += contexts[i].checked;
+            stats->missing += contexts[i].missing;
+            stats->mismatched += contexts[i].mismatched;
+            stats->skipped += contexts[i].skipped;
+        }
+    }
+
+    for (i = 0; i < MAX_MCC_INDEX; ++i) {
+        struct verify_file *file = &shared->files[i];
+        if (file->map == NULL) {
+            continue;
+        }
+        for (j = 0; !error && file->seen && j < file->count; ++j) {
+            if (!file->seen[j]) {
+                if (stats->extra++ < VERIFY_MAX_REPORTED) {
+                    uint64_t key = file->keys[j];
+                    fprintf(stderr, "EXTRA: mcc %d net %lu area %lu cell %lu %s is not in the CSV\n",
+                            mccMap[i], (key >> 46) & 0x3FF, (key >> 30) & 0xFFFF,
+                            (key >> 2) & 0xFFFFFFF, radioNames[key & 3]);
+                }
+            }
+        }
+        free(file->seen);
+        munmap(file->map, file->map_size);
+        if (file->metas != NULL) {
+            munmap((void *)file->metas, file->meta_size);
+        }
+    }
+    free(shared);
+    free(contexts);
+    free(context_ptrs);
+    return error;
+}
@@ -0,0 +1,52 @@
+/*
+  Copyright (C) 2022 Jolla Ltd.
+  Contact: Daniel Suni <daniel.suni@jolla.com>
+
+  This file is part of geoclue-mlsdb.
+
+  Geoclue-mlsdb is free software; you can redistribute it and/or
+  modify it under the terms of the GNU Lesser General Public
+  License as published by the Free Software Foundation; either
+  version 2.1 of the License.
+*/
+
+#ifndef GEOCLUE_MLSDB_TOOL_VERIFY_H
+#define GEOCLUE_MLSDB_TOOL_VERIFY_H
+
+#include <stddef.h>
+
+#define VERIFY_TOLERANCE 0.00001 // Degrees, i.e. roughly a metre.
+#define VERIFY_MAX_REPORTED 20   // Mismatches printed in detail.
+
+/*
+Checks previously built .dat files against the CSV data they were built from.
+
+First every .dat file is checked on its own: the size must be a multiple of
+the record size, and the keys must be in ascending order. Equal adjacent keys
+are reported as duplicates, since the provider can only ever find one of them.
+
+Then the CSV is parsed with the same worker pool as a build, and every record
+is looked up in its .dat file with a binary search, just like the provider
+does. The coordinates must match within VERIFY_TOLERANCE, and if there is a
+.meta file, its range and sample count must match exactly. Finally, records
+which are in a .dat file but not in the CSV are reported as extra.
+
+Only the mccs that have a .dat file, or that have been selected with
+select_mccs(), are checked. Lines for other mccs are ignored.
+*/
+
+struct verify_stats {
+    size_t files;
+    size_t checked;
+    size_t missing;
+    size_t mismatched;
+    size_t duplicates;
+    size_t misordered;
+    size_t extra;
+    size_t skipped;
+};
+
+int verify_dat_files(int fd, const char *dir, unsigned thread_count, size_t *total_bytes,
+                     struct verify_stats *stats);
+
+#endif // GEOCLUE_MLSDB_TOOL_VERIFY_H
@@ -0,0 +1,81 @@
+#!/bin/bash
+set -e
+
+# Measures how long D-Bus clients wait for GetPosition while the provider
+# looks cells up from cold data files, and compares that with the wait while
+# the cells are already cached. Run it on the device as the user, with the
+# modem registered so that there are cells to look up:
+#   latency_test.sh [rounds] [seconds per round]
+# Run it with devel-su -p to have the page cache dropped before every cold
+# round, so that the lookups really read the storage.
+#
+# Every cold round restarts the provider without its snapshot, starts
+# positioning with AddReference and calls GetPosition back to back for the
+# length of the round. The warm rounds do the same without the restart. The
+# times include starting dbus-send, which costs the same in both; the
+# percentiles of the cold rounds should stay close to the warm ones.
+
+SERVICE=org.freedesktop.Geoclue.Providers.Mlsdb
+OBJECT=/org/freedesktop/Geoclue/Providers/Mlsdb
+rounds=${1:-5}
+seconds=${2:-2}
+snapshot=${XDG_CACHE_HOME:-$HOME/.cache}/geoclue-mlsdb/snapshot
+workdir=`mktemp -d`
+trap "rm -rf $workdir" EXIT
+
+call() {
+    dbus-send --session --print-reply --dest=$SERVICE $OBJECT $1 > /dev/null
+}
+
+# Appends the latency of every GetPosition call to $1, in microseconds.
+sample() {
+    local end=$((`date +%s` + seconds))
+    while [ `date +%s` -lt $end ] ; do
+        local start=`date +%s%N`
+        call org.freedesktop.Geoclue.Position.GetPosition
+        echo $(((`date +%s%N` - start) / 1000)) >> $1
+    done
+}
+
+round() {
+    sample $1 &
+    call org.freedesktop.Geoclue.AddReference
+    wait
+}
+
+report() {
+    sort -n $workdir/$1 | awk -v name=$1 '
+        { t[NR] = $1 }
+        END {
+            if (NR == 0) { print name ": no calls"; exit 1 }
+            printf "%s: %d calls, p50 %.1f ms, p90 %.1f ms, p99 %.1f ms, max %.1f ms\n", name, NR,
+                   t[int((NR - 1) * 0.5) + 1] / 1000, t[int((NR - 1) * 0.9) + 1] / 1000,
+                   t[int((NR - 1) * 0.99) + 1] / 1000, t[NR] / 1000
+        }'
+}
+
+if ! call org.freedesktop.Geoclue.GetStatus ; then
+    echo "ERROR: Can't reach $SERVICE on the session bus" >&2
+    exit 1
+fi
+
+for i in `seq $rounds` ; do
+    pkill -f /usr/libexec/geoclue-mlsdb || true
+    while pgrep -f /usr/libexec/geoclue-mlsdb > /dev/null ; do
+        sleep 0.1
+    done
+    rm -f $snapshot
+    if [ -w /proc/sys/vm/drop_caches ] ; then
+        sync
+        echo 3 > /proc/sys/vm/drop_caches
+    fi
+    call org.freedesktop.Geoclue.GetStatus # starts the provider, not measured
+    round cold
+done
+
+for i in `seq $rounds` ; do
+    round warm
+done
+
+report cold
+report warm
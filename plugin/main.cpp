@@ -15,15 +15,20 @@
 #include <QtDBus/QDBusConnection>
 
 #include "mlsdbprovider.h"
+#include "mlsdbstartuptrace.h"
 
 Q_DECL_EXPORT int main(int argc, char *argv[])
 {
+    mlsdbStartupTrace("main");
     QCoreApplication a(argc, argv);
+    mlsdbStartupTrace("application created");
     MlsdbProvider provider;
+    mlsdbStartupTrace("provider created");
     QDBusConnection connection = QDBusConnection::sessionBus();
     if (!connection.registerObject(QStringLiteral("/org/freedesktop/Geoclue/Providers/Mlsdb"), &provider))
         qFatal("Failed to register object /org/freedesktop/Geoclue/Providers/Mlsdb - is another instance of the plugin already running?");
     if (!connection.registerService(QStringLiteral("org.freedesktop.Geoclue.Providers.Mlsdb")))
         qFatal("Failed to register service org.freedesktop.Geoclue.Providers.Mlsdb - is another instance of the plugin already running?");
+    mlsdbStartupTrace("registered on the bus");
     return a.exec();
 }
@@ -0,0 +1,397 @@
+/*
+    Copyright (C) 2022 Jolla Ltd.
+    Contact: Daniel Suni <daniel.suni@jolla.com>
+
+    This file is part of geoclue-mlsdb.
+
+    Geoclue-mlsdb is free software; you can redistribute it and/or
+    modify it under the terms of the GNU Lesser General Public
+    License as published by the Free Software Foundation; either
+    version 2.1 of the License.
+*/
+
+#include "mlsdbcelllocator.h"
+#include "mlsdblogging.h"
+
+#include "mlsdbcellmeta.h"
+#include "mlsdbsnapshot.h"
+
+#include <QtCore/QDateTime>
+#include <QtCore/QMetaObject>
+#include <QtCore/QMutexLocker>
+
+#include <algorithm>
+#include <stdio.h>
+#include <math.h>
+
+#define DATA_SIZE 8 // 64 bits / 8 bits to the byte
+
+namespace {
+    const int MinimumCalculatedAccuracy = 2500; // 2500 metres - arbitrary but large, manual cell-based triangulation is error-prone.
+    const double MinimumMetadataAccuracy = 200; // 200 metres, the best accuracy claimed when cell ranges are known.
+    const double UnknownCellRange = 10000;      // 10km, assumed range of cells without range data.
+    const double HalfConfidenceSamples = 10;    // a cell position based on this many samples is given half weight.
+    const double EarthRadius = 6371000;         // metres
+    const double OutlierDistance = 50000;       // 50km, cells closer than this (plus their range) to the others are never outliers
+    const double OutlierMads = 5;               // median absolute deviations, cells further off than this are outliers
+
+    // partially reorders values.
+    double median(double *values, int count)
+    {
+        double *middle = values + count / 2;
+        std::nth_element(values, middle, values + count);
+        return *middle;
+    }
+}
+
+MlsdbCellLocator::MlsdbCellLocator(const MlsdbSnapshot *snapshot, QObject *parent)
+:   QObject(parent),
+    m_snapshot(snapshot),
+    m_requestedFingerprint(0),
+    m_requestQueued(false),
+    m_useCount(0),
+    m_resolvedCount(0)
+{
+    m_cache.reserve(CacheCapacity);
+}
+
+MlsdbCellLocator::~MlsdbCellLocator()
+{
+    qDeleteAll(m_dataFiles);
+}
+
+QString MlsdbCellLocator::dataDirectory()
+{
+    return QStringLiteral("/usr/share/geoclue-provider-mlsdb/data/");
+}
+
+/*
+    Called on the provider's thread. The cells are copied into a buffer which
+    the locator thread copies them out of, instead of into a queued signal,
+    which would allocate for every request.
+*/
+void MlsdbCellLocator::requestEstimate(quint64 fingerprint, const MlsdbSeenCells &cells)
+{
+    QMutexLocker locker(&m_requestMutex);
+    m_requestedCells = cells;
+    m_requestedFingerprint = fingerprint;
+    if (!m_requestQueued) {
+        m_requestQueued = true;
+        QMetaObject::invokeMethod(this, "estimateRequested", Qt::QueuedConnection);
+    }
+}
+
+void MlsdbCellLocator::estimateRequested()
+{
+    quint64 fingerprint;
+    {
+        QMutexLocker locker(&m_requestMutex);
+        m_cells = m_requestedCells;
+        fingerprint = m_requestedFingerprint;
+        m_requestQueued = false;
+    }
+    emit locationEstimated(fingerprint, estimateLocationFromCells(m_cells));
+}
+
+MlsdbCellLocator::CachedCell *MlsdbCellLocator::findCachedCell(quint64 uniqueCellId)
+{
+    CachedCell *begin = m_cache.data();
+    CachedCell *end = begin + m_cache.size();
+    CachedCell *cached = std::lower_bound(begin, end, uniqueCellId,
+                                          [](const CachedCell &c, quint64 id) { return c.uniqueCellId < id; });
+    return cached != end && cached->uniqueCellId == uniqueCellId ? cached : 0;
+}
+
+/*
+    Only called when a cell is seen for the first time, so a linear search for
+    the least recently used cell to make room is fine. The cache never grows
+    beyond the capacity reserved up front, so inserting just moves the cells
+    after the new one along.
+*/
+void MlsdbCellLocator::cacheCell(quint64 uniqueCellId, const CellLocation *location)
+{
+    if (m_cache.size() == CacheCapacity) {
+        int oldest = 0;
+        for (int i = 1; i < m_cache.size(); ++i) {
+            if (m_cache.at(i).lastUsed < m_cache.at(oldest).lastUsed) {
+                oldest = i;
+            }
+        }
+        m_cache.remove(oldest);
+    }
+
+    CachedCell cell;
+    cell.uniqueCellId = uniqueCellId;
+    cell.location = location ? *location : CellLocation();
+    cell.lastUsed = m_useCount;
+    cell.known = location != 0;
+    QVector<CachedCell>::iterator it = std::lower_bound(m_cache.begin(), m_cache.end(), uniqueCellId,
+                                                        [](const CachedCell &c, quint64 id) { return c.uniqueCellId < id; });
+    m_cache.insert(it, cell);
+}
+
+// TODO: Search alternative locations for files with mlsdb data
+bool MlsdbCellLocator::searchForCellIdLocation(quint64 uniqueCellId, CellLocation *location)
+{
+    if (uniqueCellId == 0) {
+        return false;
+    }
+    const DataFile *data = dataFile(getCellMcc(uniqueCellId));
+    const quint64 uid = uniqueCellId & 0xFFFFFFFFFFFFFF;
+    const quint64 *end = data->networks + data->count;
+    const quint64 *network = std::lower_bound(data->networks, end, uid);
+    if (network == end || *network != uid) {
+        return false;
+    }
+    const size_t index = network - data->networks;
+    location->coords = data->coords[index];
+    // The .meta file is optional, see mlsdbcellmeta.h
+    if (data->metas) {
+        location->range = mlsdbDecodeRange(data->metas[index * MLSDB_META_SIZE]);
+        location->samples = mlsdbDecodeSamples(data->metas[index * MLSDB_META_SIZE + 1]);
+    } else {
+        location->range = 0;
+        location->samples = 0;
+    }
+    return true;
+}
+
+/*
+    Maps the files of the mcc when it is first looked up. The lookups are
+    then plain memory reads, and a missing or corrupt file is only reported
+    once. The .meta file is only used if it has metadata for every record of
+    the .dat file.
+*/
+const MlsdbCellLocator::DataFile *MlsdbCellLocator::dataFile(quint16 mcc)
+{
+    QHash<quint16, DataFile *>::const_iterator it = m_dataFiles.constFind(mcc);
+    if (it != m_dataFiles.constEnd()) {
+        return *it;
+    }
+
+    DataFile *data = new DataFile;
+    data->networks = 0;
+    data->coords = 0;
+    data->metas = 0;
+    data->count = 0;
+    m_dataFiles.insert(mcc, data);
+
+    const QString path = dataDirectory() + QString::number(mcc);
+    data->datFile.setFileName(path + QStringLiteral(".dat"));
+    if (!data->datFile.open(QIODevice::ReadOnly)) {
+        fprintf(stderr, "WARNING: Unable to open data file for mcc %d\n", mcc);
+        return data;
+    }
+    const qint64 filesize = data->datFile.size();
+    if (filesize % (2 * DATA_SIZE) != 0) {
+        fprintf(stderr, "ERROR: File size is not a multiple of data size. Corrupt file?\n");
+        data->datFile.close();
+        return data;
+    }
+    const uchar *map = filesize > 0 ? data->datFile.map(0, filesize) : 0;
+    if (!map) {
+        data->datFile.close();
+        return data;
+    }
+    data->count = filesize / (2 * DATA_SIZE);
+    data->networks = reinterpret_cast<const quint64 *>(map);
+    data->coords = reinterpret_cast<const MlsdbCoords *>(map + filesize / 2);
+
+    data->metaFile.setFileName(path + QStringLiteral(".meta"));
+    if (!data->metaFile.open(QIODevice::ReadOnly)) {
+        return data;
+    }
+    if (data->metaFile.size() != (qint64)(data->count * MLSDB_META_SIZE)) {
+        fprintf(stderr, "WARNING: Ignoring metadata file which does not match the data file\n");
+        data->metaFile.close();
+        return data;
+    }
+    data->metas = data->metaFile.map(0, data->metaFile.size());
+    if (!data->metas) {
+        data->metaFile.close();
+    }
+    return data;
+}
+
+/*
+    Cells are weighted by signal strength. When the range and sample count of
+    a cell are known, its weight is further scaled by the inverse of its
+    coverage area (a small cell pins the position down better), and by how
+    well its position is known.
+*/
+double MlsdbCellLocator::cellWeight(const MlsdbCellPositioningData &cell, const CellLocation &location)
+{
+    double weight = qMax(1u, cell.signalStrength);
+    if (location.range > 0) {
+        double range = location.range / UnknownCellRange;
+        weight /= qMax(0.0001, range * range);
+        if (location.samples > 0) {
+            weight *= location.samples / (location.samples + HalfConfidenceSamples);
+        }
+    }
+    return weight;
+}
+
+/*
+    A cell which has moved since it was mapped, or which was mapped wrong,
+    can be hundreds of kilometres away from the others, and would drag the
+    estimate with it. The distances of the cells from their median position
+    are compared to the median of those distances, and the cells much further
+    off than the rest are dropped. With fewer than three cells there is no
+    telling which one is wrong.
+
+    Rejected cells are only left out of this estimate. They stay cached, as
+    with a different set of cells around them they may well fit in.
+*/
+void MlsdbCellLocator::rejectOutliers()
+{
+    if (m_resolvedCount < 3) {
+        return;
+    }
+
+    for (int i = 0; i < m_resolvedCount; ++i) {
+        m_medianBuffer[i] = m_resolvedCells[i].location.coords.lat;
+    }
+    const double medianLatitude = median(m_medianBuffer, m_resolvedCount);
+    for (int i = 0; i < m_resolvedCount; ++i) {
+        m_medianBuffer[i] = m_resolvedCells[i].location.coords.lon;
+    }
+    const double medianLongitude = median(m_medianBuffer, m_resolvedCount);
+
+    for (int i = 0; i < m_resolvedCount; ++i) {
+        m_medianBuffer[i] = approximateDistance(medianLatitude, medianLongitude,
+                                                m_resolvedCells[i].location.coords.lat,
+                                                m_resolvedCells[i].location.coords.lon);
+    }
+    const double limit = qMax(OutlierDistance, OutlierMads * median(m_medianBuffer, m_resolvedCount));
+
+    int kept = 0;
+    for (int i = 0; i < m_resolvedCount; ++i) {
+        const ResolvedCell resolved = m_resolvedCells[i];
+        const double distance = approximateDistance(medianLatitude, medianLongitude,
+                                                    resolved.location.coords.lat, resolved.location.coords.lon);
+        if (distance > limit + resolved.location.range) {
+            qCDebug(lcGeoclueMlsdbPosition) << "rejecting cell with id:" << resolved.uniqueCellId
+                                            << "which is" << distance / 1000 << "km away from the others";
+        } else {
+            m_resolvedCells[kept++] = resolved;
+        }
+    }
+    m_resolvedCount = kept;
+}
+
+// Equirectangular approximation, which is plenty for the distances between neighbouring cells.
+double MlsdbCellLocator::approximateDistance(double lat1, double lon1, double lat2, double lon2)
+{
+    const double degreesToRadians = M_PI / 180.0;
+    double x = (lon2 - lon1) * degreesToRadians * cos((lat1 + lat2) / 2 * degreesToRadians);
+    double y = (lat2 - lat1) * degreesToRadians;
+    return sqrt(x * x + y * y) * EarthRadius;
+}
+
+Location MlsdbCellLocator::estimateLocationFromCells(const MlsdbSeenCells &cells)
+{
+    // determine which cells we have an accurate location for, from MLSDB data.
+    ++m_useCount;
+    m_resolvedCount = 0;
+    for (const MlsdbCellPositioningData &cell : cells) {
+        ResolvedCell resolved;
+        CachedCell *cached = findCachedCell(cell.uniqueCellId);
+        if (cached) {
+            cached->lastUsed = m_useCount;
+            if (!cached->known) {
+                // we know that we don't know the location of this cellId.  Skip it.
+                qCDebug(lcGeoclueMlsdbPosition) << "do not know position of cell with id: " << cell.uniqueCellId;
+                continue;
+            }
+            resolved.location = cached->location;
+        } else if (m_snapshot && m_snapshot->isUnknownCell(cell.uniqueCellId)) {
+            // we knew that before the restart already.
+            qCDebug(lcGeoclueMlsdbPosition) << "do not know position of cell with id: " << cell.uniqueCellId;
+            cacheCell(cell.uniqueCellId, 0);
+            continue;
+        } else {
+            // this is a new cell Id that we haven't encountered yet, unless we did before
+            // the restart.  Probe it.
+            if (!(m_snapshot && m_snapshot->findCell(cell.uniqueCellId, &resolved.location))
+                    && !searchForCellIdLocation(cell.uniqueCellId, &resolved.location)) {
+                // we now know that we don't know the location of this cellId.
+                qCDebug(lcGeoclueMlsdbPosition) << "do not know position of cell with id: " << cell.uniqueCellId;
+                cacheCell(cell.uniqueCellId, 0);
+                continue;
+            }
+            // cache the location of the cell id for future reference.
+            cacheCell(cell.uniqueCellId, &resolved.location);
+        }
+        // we have a known location for this cell.  Update our locations list.
+        resolved.uniqueCellId = cell.uniqueCellId;
+        resolved.weight = cellWeight(cell, resolved.location);
+        m_resolvedCells[m_resolvedCount++] = resolved;
+    }
+    rejectOutliers();
+
+    double totalWeight = 0.0;
+    bool haveRanges = false;
+    for (int i = 0; i < m_resolvedCount; ++i) {
+        totalWeight += m_resolvedCells[i].weight;
+        haveRanges |= m_resolvedCells[i].location.range > 0;
+    }
+
+    if (m_resolvedCount == 0) {
+        qCDebug(lcGeoclueMlsdbPosition) << "no cell id data to calculate position from";
+        return Location();
+    } else if (m_resolvedCount == 1) {
+        qCDebug(lcGeoclueMlsdbPosition) << "only one cell id datum to calculate position from, position will be extremely inaccurate";
+    } else if (m_resolvedCount == 2) {
+        qCDebug(lcGeoclueMlsdbPosition) << "only two cell id data to calculate position from, position will be highly inaccurate";
+    } else {
+        qCDebug(lcGeoclueMlsdbPosition) << "calculating position from" << m_resolvedCount << "cell id data";
+    }
+
+    // now use the current cell and neighboringcell information to triangulate our position.
+    double deviceLatitude = 0.0;
+    double deviceLongitude = 0.0;
+    for (int i = 0; i < m_resolvedCount; ++i) {
+        const ResolvedCell &resolved(m_resolvedCells[i]);
+        const CellLocation &cellLocation(resolved.location);
+        double weight = resolved.weight / totalWeight;
+        deviceLatitude += (weight * cellLocation.coords.lat);
+        deviceLongitude += (weight * cellLocation.coords.lon);
+        qCDebug(lcGeoclueMlsdbPosition) << "have cell: " << resolved.uniqueCellId
+                                        << "with position: " << cellLocation.coords.lat << "," << cellLocation.coords.lon
+                                        << "with range: " << cellLocation.range
+                                        << "with samples: " << cellLocation.samples
+                                        << "with weight: " << weight;
+    }
+
+    // the weighted rms of the distances to the cells, i.e. how far apart the cells are,
+    // and of the cell ranges where they are known.
+    double spread = 0.0;
+    double ranges = 0.0;
+    for (int i = 0; i < m_resolvedCount; ++i) {
+        const ResolvedCell &resolved(m_resolvedCells[i]);
+        const CellLocation &cellLocation(resolved.location);
+        double weight = resolved.weight / totalWeight;
+        double range = cellLocation.range > 0 ? cellLocation.range : UnknownCellRange;
+        double distance = approximateDistance(deviceLatitude, deviceLongitude,
+                                              cellLocation.coords.lat, cellLocation.coords.lon);
+        spread += weight * distance * distance;
+        ranges += weight * range * range;
+    }
+
+    Location deviceLocation;
+    Accuracy positionAccuracy;
+    if (haveRanges) {
+        positionAccuracy.setHorizontal(qMax(MinimumMetadataAccuracy, sqrt(ranges + spread)));
+    } else {
+        // estimate accuracy based on how many cells we have, unless they are spread out further.
+        positionAccuracy.setHorizontal(qMax(double(qMax(MinimumCalculatedAccuracy,
+                                                        10000 - (1000 * m_resolvedCount))),
+                                            sqrt(spread)));
+    }
+    deviceLocation.setTimestamp(QDateTime::currentMSecsSinceEpoch());
+    deviceLocation.setLatitude(deviceLatitude);
+    deviceLocation.setLongitude(deviceLongitude);
+    deviceLocation.setAccuracy(positionAccuracy);
+    return deviceLocation;
+}
@@ -0,0 +1,126 @@
+/*
+    Copyright (C) 2022 Jolla Ltd.
+    Contact: Daniel Suni <daniel.suni@jolla.com>
+
+    This file is part of geoclue-mlsdb.
+
+    Geoclue-mlsdb is free software; you can redistribute it and/or
+    modify it under the terms of the GNU Lesser General Public
+    License as published by the Free Software Foundation; either
+    version 2.1 of the License.
+*/
+
+#ifndef MLSDBCELLLOCATOR_H
+#define MLSDBCELLLOCATOR_H
+
+#include <QtCore/QObject>
+#include <QtCore/QFile>
+#include <QtCore/QHash>
+#include <QtCore/QMutex>
+#include <QtCore/QVector>
+
+#include "locationtypes.h"
+#include "mlsdbcells.h"
+#include "mlsdbserialisation.h"
+
+class MlsdbSnapshot;
+
+/*
+ * The MlsdbCellLocator class estimates the position of the device
+ * from the cells it sees, looking the cells up from the data files.
+ *
+ * The lookups block on file I/O, so the provider runs the locator
+ * in a thread of its own. The cells are handed over in a buffer shared
+ * with that thread, and the estimate comes back with a queued signal.
+ *
+ * Once the cells around have been looked up, estimating the position
+ * from them again doesn't allocate memory.
+ */
+
+class MlsdbCellLocator : public QObject
+{
+    Q_OBJECT
+
+public:
+    struct CellLocation {
+        MlsdbCoords coords;
+        double range;   // metres, 0 if unknown (no .meta file)
+        double samples; // 0 if unknown
+    };
+
+    // snapshot, if given, must outlive the locator.
+    explicit MlsdbCellLocator(const MlsdbSnapshot *snapshot, QObject *parent = 0);
+    ~MlsdbCellLocator();
+
+    static QString dataDirectory();
+
+    struct CachedCell {
+        quint64 uniqueCellId;
+        CellLocation location; // only if known
+        quint32 lastUsed;      // the estimate which last saw the cell, later ones are higher
+        bool known;            // false if the cell is in neither the snapshot nor the data files
+    };
+
+    // Thread safe. If the locator is still busy with an earlier request,
+    // only the latest cells are estimated, and locationEstimated() is only
+    // emitted for them.
+    void requestEstimate(quint64 fingerprint, const MlsdbSeenCells &cells);
+
+    // Blocks on file I/O when cells are looked up for the first time.
+    Location estimateLocationFromCells(const MlsdbSeenCells &cells);
+
+    // Sorted by uniqueCellId. Only to be used while the locator thread isn't running.
+    const QVector<CachedCell> &cache() const { return m_cache; }
+
+signals:
+    // location is invalid (timestamp 0) if none of the cells are known.
+    void locationEstimated(quint64 fingerprint, const Location &location);
+
+private Q_SLOTS:
+    void estimateRequested();
+
+private:
+    enum { CacheCapacity = 4096 };
+
+    struct ResolvedCell {
+        quint64 uniqueCellId;
+        CellLocation location;
+        double weight;
+    };
+
+    // The .dat and .meta files of an mcc, mapped on first use and kept
+    // mapped for the lifetime of the locator.
+    struct DataFile {
+        QFile datFile;
+        QFile metaFile;
+        const quint64 *networks; // sorted
+        const MlsdbCoords *coords;
+        const uchar *metas;      // 0 if there is no usable .meta file
+        size_t count;            // 0 if there is no usable .dat file
+    };
+
+    CachedCell *findCachedCell(quint64 uniqueCellId);
+    void cacheCell(quint64 uniqueCellId, const CellLocation *location);
+    void rejectOutliers();
+    static double cellWeight(const MlsdbCellPositioningData &cell, const CellLocation &location);
+    static double approximateDistance(double lat1, double lon1, double lat2, double lon2);
+    bool searchForCellIdLocation(quint64 uniqueCellId, CellLocation *location);
+    const DataFile *dataFile(quint16 mcc);
+
+    const MlsdbSnapshot *m_snapshot;
+    QHash<quint16, DataFile *> m_dataFiles;
+
+    QMutex m_requestMutex;
+    MlsdbSeenCells m_requestedCells; // guarded by m_requestMutex, like the two below
+    quint64 m_requestedFingerprint;
+    bool m_requestQueued;
+    MlsdbSeenCells m_cells;          // the request being estimated
+
+    QVector<CachedCell> m_cache;     // preallocated with CacheCapacity, see cacheCell()
+    quint32 m_useCount;              // estimates so far
+    ResolvedCell m_resolvedCells[MlsdbSeenCells::Capacity];
+    int m_resolvedCount;
+    double m_medianBuffer[MlsdbSeenCells::Capacity]; // used by rejectOutliers()
+};
+
+#endif // MLSDBCELLLOCATOR_H
@@ -0,0 +1,68 @@
+/*
+    Copyright (C) 2022 Jolla Ltd.
+    Contact: Daniel Suni <daniel.suni@jolla.com>
+
+    This file is part of geoclue-mlsdb.
+
+    Geoclue-mlsdb is free software; you can redistribute it and/or
+    modify it under the terms of the GNU Lesser General Public
+    License as published by the Free Software Foundation; either
+    version 2.1 of the License.
+*/
+
+#ifndef MLSDBCELLS_H
+#define MLSDBCELLS_H
+
+#include <QtCore/QtGlobal>
+
+struct MlsdbCellPositioningData {
+    quint64 uniqueCellId;
+    quint32 signalStrength;
+};
+
+/*
+ * The cells seen at one time. They are kept in an array of fixed size, so
+ * that collecting them, handing them to the cell locator thread and looking
+ * them up never allocates. A modem reports a dozen cells at most, the rest
+ * of the cells are ignored if it ever reports more than Capacity.
+ */
+
+class MlsdbSeenCells
+{
+public:
+    enum { Capacity = 64 };
+
+    MlsdbSeenCells() : m_count(0) { }
+
+    void clear() { m_count = 0; }
+    // false if full.
+    bool append(const MlsdbCellPositioningData &cell)
+    {
+        if (m_count == Capacity) {
+            return false;
+        }
+        m_cells[m_count++] = cell;
+        return true;
+    }
+    bool contains(quint64 uniqueCellId) const
+    {
+        for (int i = 0; i < m_count; ++i) {
+            if (m_cells[i].uniqueCellId == uniqueCellId) {
+                return true;
+            }
+        }
+        return false;
+    }
+
+    int size() const { return m_count; }
+    bool isEmpty() const { return m_count == 0; }
+    const MlsdbCellPositioningData &at(int i) const { return m_cells[i]; }
+    const MlsdbCellPositioningData *begin() const { return m_cells; }
+    const MlsdbCellPositioningData *end() const { return m_cells + m_count; }
+
+private:
+    MlsdbCellPositioningData m_cells[Capacity];
+    int m_count;
+};
+
+#endif // MLSDBCELLS_H
@@ -0,0 +1,122 @@
+/*
+    Copyright (C) 2022 Jolla Ltd.
+    Contact: Daniel Suni <daniel.suni@jolla.com>
+
+    This file is part of geoclue-mlsdb.
+
+    Geoclue-mlsdb is free software; you can redistribute it and/or
+    modify it under the terms of the GNU Lesser General Public
+    License as published by the Free Software Foundation; either
+    version 2.1 of the License.
+*/
+
+#include "mlsdbidlepolicy.h"
+#include "mlsdblogging.h"
+
+#include <QtGlobal>
+
+#include <algorithm>
+#include <stdio.h>
+#include <unistd.h>
+
+namespace {
+    const int DefaultMinimumIdleTime = 30000;   // 30s
+    const int DefaultMaximumIdleTime = 300000;  // 5min
+    const int MaxActivationTimes = 16;
+    const int MinimumPatternGaps = 2;           // a single gap between activations isn't a pattern yet
+    const double IdleMargin = 1.25;             // clients don't activate exactly on time
+
+    int idleTimeFromEnvironment(const char *name, int defaultValue)
+    {
+        bool ok = false;
+        const int seconds = qEnvironmentVariableIntValue(name, &ok);
+        return ok && seconds > 0 ? seconds * 1000 : defaultValue;
+    }
+
+    // in bytes, 0 if unknown.
+    qint64 residentMemory()
+    {
+        FILE *statm = fopen("/proc/self/statm", "r");
+        if (!statm)
+            return 0;
+        long size = 0;
+        long resident = 0;
+        const bool ok = fscanf(statm, "%ld %ld", &size, &resident) == 2;
+        fclose(statm);
+        return ok ? qint64(resident) * sysconf(_SC_PAGESIZE) : 0;
+    }
+}
+
+MlsdbIdlePolicy::MlsdbIdlePolicy()
+:   m_minimumIdleTime(idleTimeFromEnvironment("GEOCLUE_MLSDB_MIN_IDLE_TIME", DefaultMinimumIdleTime)),
+    m_maximumIdleTime(qMax(m_minimumIdleTime,
+                           idleTimeFromEnvironment("GEOCLUE_MLSDB_MAX_IDLE_TIME", DefaultMaximumIdleTime))),
+    m_idleSince(0),
+    m_avoidedActivations(0),
+    m_extraIdleTime(0)
+{
+}
+
+void MlsdbIdlePolicy::setActivationTimes(const QVector<qint64> &activationTimes)
+{
+    m_activationTimes = activationTimes.mid(qMax(0, activationTimes.size() - MaxActivationTimes));
+}
+
+void MlsdbIdlePolicy::activated(qint64 now)
+{
+    if (m_idleSince != 0 && now - m_idleSince > m_minimumIdleTime) {
+        // with the minimum idle time, the provider would have been started again for this.
+        ++m_avoidedActivations;
+        qCDebug(lcGeoclueMlsdb) << "client arrived after" << (now - m_idleSince) / 1000
+                                << "s idle, avoided restarting";
+    }
+    endIdle(now);
+
+    m_activationTimes.append(now);
+    if (m_activationTimes.size() > MaxActivationTimes)
+        m_activationTimes.remove(0);
+}
+
+void MlsdbIdlePolicy::idleStarted(qint64 now)
+{
+    m_idleSince = now;
+}
+
+void MlsdbIdlePolicy::quitting(qint64 now)
+{
+    endIdle(now);
+    qCDebug(lcGeoclueMlsdb) << "avoided" << m_avoidedActivations << "activations by staying resident for"
+                            << m_extraIdleTime / 1000 << "s longer, using" << residentMemory() / 1024 << "kB";
+}
+
+void MlsdbIdlePolicy::endIdle(qint64 now)
+{
+    if (m_idleSince == 0)
+        return;
+    m_extraIdleTime += qMax(Q_INT64_C(0), now - m_idleSince - m_minimumIdleTime);
+    m_idleSince = 0;
+}
+
+/*
+    The median of the recent times between activations, so that an odd long
+    session or a quiet night doesn't throw it off.
+*/
+int MlsdbIdlePolicy::idleTimeout() const
+{
+    QVector<qint64> gaps;
+    for (int i = 1; i < m_activationTimes.size(); ++i) {
+        const qint64 gap = m_activationTimes.at(i) - m_activationTimes.at(i - 1);
+        if (gap > 0)
+            gaps.append(gap);
+    }
+    if (gaps.size() < MinimumPatternGaps)
+        return m_minimumIdleTime;
+
+    std::nth_element(gaps.begin(), gaps.begin() + gaps.size() / 2, gaps.end());
+    const qint64 timeout = gaps.at(gaps.size() / 2) * IdleMargin;
+    if (timeout > m_maximumIdleTime) {
+        // clients come too rarely to be worth waiting for.
+        return m_minimumIdleTime;
+    }
+    return qMax<qint64>(m_minimumIdleTime, timeout);
+}
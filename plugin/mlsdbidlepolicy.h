@@ -0,0 +1,57 @@
+/*
+    Copyright (C) 2022 Jolla Ltd.
+    Contact: Daniel Suni <daniel.suni@jolla.com>
+
+    This file is part of geoclue-mlsdb.
+
+    Geoclue-mlsdb is free software; you can redistribute it and/or
+    modify it under the terms of the GNU Lesser General Public
+    License as published by the Free Software Foundation; either
+    version 2.1 of the License.
+*/
+
+#ifndef MLSDBIDLEPOLICY_H
+#define MLSDBIDLEPOLICY_H
+
+#include <QtCore/QVector>
+
+/*
+ * Decides how long the provider stays around without clients before it
+ * quits. Clients such as widgets often ask for the position every minute
+ * or so, and quitting in between means paying for the startup each time.
+ *
+ * The times at which positioning was activated (the first AddReference
+ * while no clients were active) are remembered across restarts. When the
+ * typical time between activations fits within the maximum idle time, the
+ * provider waits a little longer than that before quitting, otherwise only
+ * the minimum idle time. The bounds are 30 s and 5 min, and can be changed
+ * with GEOCLUE_MLSDB_MIN_IDLE_TIME and GEOCLUE_MLSDB_MAX_IDLE_TIME (seconds).
+ */
+
+class MlsdbIdlePolicy
+{
+public:
+    MlsdbIdlePolicy();
+
+    // msecs since epoch, oldest first.
+    void setActivationTimes(const QVector<qint64> &activationTimes);
+    QVector<qint64> activationTimes() const { return m_activationTimes; }
+
+    void activated(qint64 now);
+    void idleStarted(qint64 now);
+    void quitting(qint64 now);
+
+    int idleTimeout() const; // msecs
+
+private:
+    void endIdle(qint64 now);
+
+    int m_minimumIdleTime;
+    int m_maximumIdleTime;
+    QVector<qint64> m_activationTimes;
+    qint64 m_idleSince; // 0 while clients are active
+    int m_avoidedActivations;
+    qint64 m_extraIdleTime; // idle time beyond the minimum, summed up
+};
+
+#endif // MLSDBIDLEPOLICY_H
@@ -15,3 +15,5 @@
 Q_LOGGING_CATEGORY(lcGeoclueMlsdb, "geoclue.provider.mlsdb", QtWarningMsg)
 Q_LOGGING_CATEGORY(lcGeoclueMlsdbOnline, "geoclue.provider.mlsdb.online", QtWarningMsg)
 Q_LOGGING_CATEGORY(lcGeoclueMlsdbPosition, "geoclue.provider.mlsdb.position", QtWarningMsg)
+Q_LOGGING_CATEGORY(lcGeoclueMlsdbLatency, "geoclue.provider.mlsdb.latency", QtWarningMsg)
+Q_LOGGING_CATEGORY(lcGeoclueMlsdbWakeups, "geoclue.provider.mlsdb.wakeups", QtWarningMsg)
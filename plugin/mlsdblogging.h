@@ -18,5 +18,7 @@
 Q_DECLARE_LOGGING_CATEGORY(lcGeoclueMlsdb)
 Q_DECLARE_LOGGING_CATEGORY(lcGeoclueMlsdbOnline)
 Q_DECLARE_LOGGING_CATEGORY(lcGeoclueMlsdbPosition)
+Q_DECLARE_LOGGING_CATEGORY(lcGeoclueMlsdbLatency)
+Q_DECLARE_LOGGING_CATEGORY(lcGeoclueMlsdbWakeups)
 
 #endif
@@ -37,6 +37,7 @@
 #define REQUEST_TIMESTAMPS_TO_TRACK 10
 #define REQUEST_BASE_ADAPTIVE_INTERVAL 60000 /* 60 seconds */
 #define REQUEST_MODIFY_ADAPTIVE_INTERVAL 10000 /* 10 seconds */
+#define REQUEST_INITIAL_BACK_OFF_FACTOR 8
 
 #define DEFAULT_API_URL "https://location.services.mozilla.com/v1/geolocate"
 
@@ -76,6 +77,7 @@ MlsdbOnlineLocator::MlsdbOnlineLocator(QObject *parent)
     , m_fallbacksIpf(true)
     , m_wlanDataAllowed(true)
     , m_adaptiveInterval(REQUEST_BASE_ADAPTIVE_INTERVAL)
+    , m_backOffFactor(REQUEST_INITIAL_BACK_OFF_FACTOR)
     , m_keyFailureTime(KeyFailureTimeKey)
 {
     QString MLSConfigFile = QStringLiteral("/etc/gps_xtra.ini");
@@ -95,6 +97,7 @@ MlsdbOnlineLocator::MlsdbOnlineLocator(QObject *parent)
     connect(&m_replyTimer, &QTimer::timeout, this, &MlsdbOnlineLocator::timeoutReply);
     m_replyTimer.setInterval(REQUEST_REPLY_TIMEOUT_INTERVAL);
     m_replyTimer.setSingleShot(true);
+    m_replyTimer.setTimerType(Qt::VeryCoarseTimer);
 }
 
 MlsdbOnlineLocator::~MlsdbOnlineLocator()
@@ -141,8 +144,27 @@ void MlsdbOnlineLocator::setWlanDataAllowed(bool allowed)
     }
 }
 
+MlsdbSnapshot::OnlineState MlsdbOnlineLocator::backOffState() const
+{
+    MlsdbSnapshot::OnlineState state;
+    state.adaptiveInterval = m_adaptiveInterval;
+    state.backOffFactor = m_backOffFactor;
+    state.queryTimestamps = m_queryTimestamps;
+    return state;
+}
+
+void MlsdbOnlineLocator::setBackOffState(const MlsdbSnapshot::OnlineState &state)
+{
+    if (state.adaptiveInterval == 0) {
+        return; // no state saved.
+    }
+    m_adaptiveInterval = state.adaptiveInterval;
+    m_backOffFactor = state.backOffFactor;
+    m_queryTimestamps = state.queryTimestamps;
+}
+
 QPair<QDateTime, QVariantMap> MlsdbOnlineLocator::buildLocationQuery(
-        const QList<MlsdbProvider::CellPositioningData> &cells,
+        const MlsdbSeenCells &cells,
         const QPair<QDateTime, QVariantMap> &oldQuery) const
 {
     static bool waitForWlanInfo = true;
@@ -173,8 +195,6 @@ QPair<QDateTime, QVariantMap> MlsdbOnlineLocator::buildLocationQuery(
 
         if (firstTimeQuery || intervalExceeded || moreInfo || newCells) {
             // adaptively back-off future requests to avoid server-side throttling.
-            static quint32 backOffFactor = 8;
-
             // we want to aim for approximately 6 minutes per request.
             const qint64 deltaMsecs = (m_queryTimestamps.size() < 3)
                                     ? 0
@@ -182,18 +202,18 @@ QPair<QDateTime, QVariantMap> MlsdbOnlineLocator::buildLocationQuery(
             const double minutesPerQuery = (m_queryTimestamps.size() < 3)
                                          ? 6
                                          : ((deltaMsecs / (1000.0 * 60.0)) / m_queryTimestamps.size());
-            if (minutesPerQuery > 6 || backOffFactor > 64) {
+            if (minutesPerQuery > 6 || m_backOffFactor > 64) {
                 // it's been a long time since the last request, reduce the back off factor.
-                backOffFactor = backOffFactor <= 2 ? 1 : (backOffFactor / 2);
+                m_backOffFactor = m_backOffFactor <= 2 ? 1 : (m_backOffFactor / 2);
             } else if (minutesPerQuery < 4) {
                 // too many recent requests, increase the back-off factor.
-                backOffFactor = backOffFactor >= 32 ? 64 : (backOffFactor * 2);
+                m_backOffFactor = m_backOffFactor >= 32 ? 64 : (m_backOffFactor * 2);
             }
 
             // max interval will be about 12 minutes (1 + 10.667 minutes).
-            m_adaptiveInterval = REQUEST_BASE_ADAPTIVE_INTERVAL + (REQUEST_MODIFY_ADAPTIVE_INTERVAL * backOffFactor);
+            m_adaptiveInterval = REQUEST_BASE_ADAPTIVE_INTERVAL + (REQUEST_MODIFY_ADAPTIVE_INTERVAL * m_backOffFactor);
 
-            if (backOffFactor == 1 || intervalExceeded) {
+            if (m_backOffFactor == 1 || intervalExceeded) {
                 // return the query data for the request.
                 qCDebug(lcGeoclueMlsdbOnline) << "Performing MLS online query due to conditions:"
                                               << "first:" << firstTimeQuery
@@ -295,6 +315,7 @@ void MlsdbOnlineLocator::requestOnlineLocationFinished(QNetworkReply *reply)
 
 void MlsdbOnlineLocator::timeoutReply()
 {
+    emit replyTimedOut();
     qCDebug(lcGeoclueMlsdbOnline) << "Request timed out at:" << QDateTime::currentDateTimeUtc().toTime_t();
     m_currentReply->setProperty("timedOut", QVariant::fromValue<bool>(true));
     m_currentReply->abort(); // will emit finished, the finished slot will deleteLater().
@@ -372,13 +393,13 @@ QVariantMap MlsdbOnlineLocator::globalFields() const
     return map;
 }
 
-QVariantMap MlsdbOnlineLocator::cellTowerFields(const QList<MlsdbProvider::CellPositioningData> &cells) const
+QVariantMap MlsdbOnlineLocator::cellTowerFields(const MlsdbSeenCells &cells) const
 {
     QVariantMap map;
     if (!cells.isEmpty()) {
         QVariantList cellTowers;
         quint32 temp;
-        Q_FOREACH (const MlsdbProvider::CellPositioningData &cell, cells) {
+        for (const MlsdbCellPositioningData &cell : cells) {
             QVariantMap cellTowerMap;
             // supported radio types: gsm, wcdma or lte
             switch (getCellType(cell.uniqueCellId)) {
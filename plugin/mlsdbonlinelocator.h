@@ -21,6 +21,7 @@
 #include <MDConfItem>
 
 #include "mlsdbprovider.h"
+#include "mlsdbsnapshot.h"
 
 QT_FORWARD_DECLARE_CLASS(QNetworkAccessManager)
 QT_FORWARD_DECLARE_CLASS(QNetworkReply)
@@ -47,15 +48,20 @@ public:
     void setWlanDataAllowed(bool allowed);
 
     QPair<QDateTime, QVariantMap> buildLocationQuery(
-        const QList<MlsdbProvider::CellPositioningData> &cells,
+        const MlsdbSeenCells &cells,
         const QPair<QDateTime, QVariantMap> &oldQuery) const;
     bool findLocation(const QPair<QDateTime, QVariantMap> &request);
 
+    // lastQueryTime is not part of it, the provider keeps track of the queries.
+    MlsdbSnapshot::OnlineState backOffState() const;
+    void setBackOffState(const MlsdbSnapshot::OnlineState &state);
+
 signals:
     void locationFound(double latitude, double longitude, double accuracy);
     void error(const QString &errorString);
     void wlanChanged();
     void wlanDataAllowedChanged();
+    void replyTimedOut(); // error() follows once the request has been aborted
 
 private Q_SLOTS:
     void networkServicesChanged();
@@ -69,7 +75,7 @@ private:
     void checkError(const QByteArray &data);
 
     QVariantMap globalFields() const;
-    QVariantMap cellTowerFields(const QList<MlsdbProvider::CellPositioningData> &cells) const;
+    QVariantMap cellTowerFields(const MlsdbSeenCells &cells) const;
     QVariantMap wlanAccessPointFields() const;
     QVariantMap fallbackFields() const;
 
@@ -93,6 +99,7 @@ private:
     bool m_wlanDataAllowed;
 
     mutable quint32 m_adaptiveInterval;
+    mutable quint32 m_backOffFactor;
     mutable QVector<qint64> m_queryTimestamps;
 
     MDConfItem m_keyFailureTime;
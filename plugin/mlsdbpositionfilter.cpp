@@ -0,0 +1,154 @@
+/*
+    Copyright (C) 2022 Jolla Ltd.
+    Contact: Daniel Suni <daniel.suni@jolla.com>
+
+    This file is part of geoclue-mlsdb.
+
+    Geoclue-mlsdb is free software; you can redistribute it and/or
+    modify it under the terms of the GNU Lesser General Public
+    License as published by the Free Software Foundation; either
+    version 2.1 of the License.
+*/
+
+#include "mlsdbpositionfilter.h"
+#include "mlsdblogging.h"
+
+#include <math.h>
+
+namespace {
+    const double AccelerationNoise = 1.0;       // m^2/s^3, how quickly the velocity is expected to change
+    const double InitialSpeedVariance = 100.0;  // (10 m/s)^2, the velocity is unknown when starting over
+    const qint64 ResetInterval = 600000;        // 10min, older state is not worth keeping
+    const double ResetDistance = 5.0;           // standard deviations, positions further off start over
+    const double MovingSpeed = 2.0;             // standard deviations, speed and direction are given above this
+    const double MetresPerDegree = 6371000 * M_PI / 180.0;
+
+    double metresPerDegreeLongitude(double latitude)
+    {
+        return qMax(1.0, MetresPerDegree * cos(latitude * M_PI / 180.0));
+    }
+}
+
+MlsdbPositionFilter::MlsdbPositionFilter()
+{
+    reset();
+}
+
+void MlsdbPositionFilter::reset()
+{
+    m_state.timestamp = 0;
+    m_state.latitude = 0;
+    m_state.longitude = 0;
+    m_state.east = 0;
+    m_state.north = 0;
+    m_state.p00 = 0;
+    m_state.p01 = 0;
+    m_state.p11 = 0;
+    m_state.bestAccuracy = 0;
+}
+
+Location MlsdbPositionFilter::update(const Location &observation)
+{
+    const double accuracy = observation.accuracy().horizontal();
+    if (observation.timestamp() == 0 || qIsNaN(accuracy) || accuracy <= 0) {
+        return observation;
+    }
+    const double variance = accuracy * accuracy;
+
+    State state = predicted(m_state, observation.timestamp());
+    const double north = (observation.latitude() - state.latitude) * MetresPerDegree;
+    const double east = (observation.longitude() - state.longitude) * metresPerDegreeLongitude(state.latitude);
+    const double innovationVariance = state.p00 + variance;
+
+    if (state.timestamp == 0 || north * north + east * east > ResetDistance * ResetDistance * innovationVariance) {
+        if (state.timestamp != 0) {
+            qCDebug(lcGeoclueMlsdbPosition) << "position is" << sqrt(north * north + east * east)
+                                            << "m off the expected one, starting over";
+        }
+        state.timestamp = observation.timestamp();
+        state.latitude = observation.latitude();
+        state.longitude = observation.longitude();
+        state.east = 0;
+        state.north = 0;
+        state.p00 = variance;
+        state.p01 = 0;
+        state.p11 = InitialSpeedVariance;
+        state.bestAccuracy = accuracy;
+    } else {
+        const double positionGain = state.p00 / innovationVariance;
+        const double velocityGain = state.p01 / innovationVariance;
+        state.latitude += positionGain * north / MetresPerDegree;
+        state.longitude += positionGain * east / metresPerDegreeLongitude(state.latitude);
+        state.north += velocityGain * north;
+        state.east += velocityGain * east;
+        state.p11 -= velocityGain * state.p01;
+        state.p01 *= 1 - positionGain;
+        state.p00 *= 1 - positionGain;
+        state.bestAccuracy = qMin(state.bestAccuracy, accuracy);
+    }
+    m_state = state;
+    return location(m_state, observation);
+}
+
+/*
+    The state stays as of the last observation, apart from the velocity, so
+    that the uncertainty is integrated over the whole time since then however
+    often the position is held meanwhile.
+*/
+Location MlsdbPositionFilter::hold(qint64 timestamp)
+{
+    if (m_state.timestamp == 0 || timestamp - m_state.timestamp > ResetInterval) {
+        return Location();
+    }
+    m_state.east = 0;
+    m_state.north = 0;
+    m_state.p01 = 0;
+
+    const double dt = qMax(Q_INT64_C(0), timestamp - m_state.timestamp) / 1000.0;
+    State held = m_state;
+    held.timestamp = qMax(timestamp, m_state.timestamp);
+    held.p00 += AccelerationNoise * dt * dt * dt / 3;
+    return location(held, Location());
+}
+
+MlsdbPositionFilter::State MlsdbPositionFilter::predicted(const State &state, qint64 timestamp)
+{
+    State prediction = state;
+    if (state.timestamp == 0 || timestamp - state.timestamp > ResetInterval) {
+        prediction.timestamp = 0;
+        return prediction;
+    }
+
+    // observations arriving out of order are taken to be simultaneous.
+    const double dt = qMax(Q_INT64_C(0), timestamp - state.timestamp) / 1000.0;
+    prediction.timestamp = qMax(timestamp, state.timestamp);
+    prediction.latitude += state.north * dt / MetresPerDegree;
+    prediction.longitude += state.east * dt / metresPerDegreeLongitude(state.latitude);
+    prediction.p00 += 2 * dt * state.p01 + dt * dt * state.p11 + AccelerationNoise * dt * dt * dt / 3;
+    prediction.p01 += dt * state.p11 + AccelerationNoise * dt * dt / 2;
+    prediction.p11 += AccelerationNoise * dt;
+    return prediction;
+}
+
+Location MlsdbPositionFilter::location(const State &state, const Location &observation)
+{
+    Location filtered = observation;
+    filtered.setTimestamp(state.timestamp);
+    filtered.setLatitude(state.latitude);
+    filtered.setLongitude(state.longitude);
+
+    Accuracy accuracy = observation.accuracy();
+    accuracy.setHorizontal(qMax(sqrt(state.p00), state.bestAccuracy));
+    filtered.setAccuracy(accuracy);
+
+    const double speed = sqrt(state.east * state.east + state.north * state.north);
+    if (speed > MovingSpeed * sqrt(state.p11)) {
+        double direction = atan2(state.east, state.north) * 180.0 / M_PI;
+        filtered.setSpeed(speed);
+        filtered.setDirection(direction < 0 ? direction + 360.0 : direction);
+    } else {
+        filtered.setSpeed(0);
+        filtered.setDirection(qQNaN());
+    }
+    return filtered;
+}
@@ -0,0 +1,70 @@
+/*
+    Copyright (C) 2022 Jolla Ltd.
+    Contact: Daniel Suni <daniel.suni@jolla.com>
+
+    This file is part of geoclue-mlsdb.
+
+    Geoclue-mlsdb is free software; you can redistribute it and/or
+    modify it under the terms of the GNU Lesser General Public
+    License as published by the Free Software Foundation; either
+    version 2.1 of the License.
+*/
+
+#ifndef MLSDBPOSITIONFILTER_H
+#define MLSDBPOSITIONFILTER_H
+
+#include "locationtypes.h"
+
+/*
+ * Fuses the successive positions from the cells and from the online
+ * service, weighted by their accuracies, into a smoother position.
+ *
+ * This is a Kalman filter with a constant velocity model, run separately
+ * for the east and north axes. The positions are given as circles, so both
+ * axes have the same covariance, which is kept only once. The filtered
+ * location carries the speed and direction once the device is clearly
+ * moving. The filter starts over after a long gap, or if a position is far
+ * outside of what it expects.
+ *
+ * The estimates from mostly the same cells have correlated errors, which the
+ * filter takes to be independent. So that repeating them doesn't make the
+ * position look ever more accurate, the accuracy given is never better than
+ * that of the best observation since the filter started over.
+ */
+
+class MlsdbPositionFilter
+{
+public:
+    MlsdbPositionFilter();
+
+    void reset();
+
+    // Returns the filtered location at the time of the observation.
+    Location update(const Location &observation);
+
+    // The filtered location brought up to timestamp when the device is known
+    // not to have moved (the cells haven't changed). The velocity is dropped
+    // and only the uncertainty grows, with the time since the last observation.
+    // Invalid (timestamp 0) if there have been no recent observations.
+    Location hold(qint64 timestamp);
+
+private:
+    struct State {
+        qint64 timestamp; // msecs since epoch, 0 if there is no state
+        double latitude;
+        double longitude;
+        double east;      // velocity, m/s
+        double north;
+        double p00;       // covariance of position (m^2), position and velocity, and velocity
+        double p01;
+        double p11;
+        double bestAccuracy; // metres, of the observations since starting over
+    };
+
+    static State predicted(const State &state, qint64 timestamp);
+    static Location location(const State &state, const Location &observation);
+
+    State m_state;
+};
+
+#endif // MLSDBPOSITIONFILTER_H
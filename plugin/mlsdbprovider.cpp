@@ -14,6 +14,9 @@
 #include "mlsdblogging.h"
 
 #include "mlsdbonlinelocator.h"
+#include "mlsdbcelllocator.h"
+#include "mlsdbsnapshot.h"
+#include "mlsdbstartuptrace.h"
 #include "geoclue_adaptor.h"
 #include "position_adaptor.h"
 
@@ -26,31 +29,26 @@
 #include <QtCore/QList>
 #include <QtDBus/QDBusConnection>
 #include <QtDBus/QDBusMessage>
+#include <QtDBus/QDBusPendingCallWatcher>
+#include <QtDBus/QDBusPendingReply>
 
 #include <qofonoextcellwatcher.h>
 
 #include <strings.h>
 #include <sys/time.h>
 
-#define DATA_SIZE 8 // 64 bits / 8 bits to the byte
-
 namespace {
     MlsdbProvider *staticProvider = 0;
-    const int MinimumCalculatedAccuracy = 2500; // 2500 metres - arbitrary but large, manual cell-based triangulation is error-prone.
-    const int QuitIdleTime = 30000;             // 30s, plugin process will kill itself if no clients request position updates in this time
-    const int FixTimeout = 30000;               // 30s, status will change from Available to Acquiring if no position update can be calculated in this time since last update.
-    const quint32 MinimumInterval = 10000;      // 10s, the shortest interval at which the plugin will recalculate position since last update
-    const quint32 ReuseInterval = 30000;        // 30s, the amount of time a previously calculated position updates will be re-used for without recalculating new position
-    const quint32 FallbackInterval = 120000;    // 120s, the amount of time a previously calculated position update with high accuracy can supercede a newly calculated low-accuracy position
-    const QString LocationSettingsDir = QStringLiteral("/var/lib/location/");
-    const QString LocationSettingsFile = QStringLiteral("/var/lib/location/location.conf");
-    const QString LocationSettingsEnabledKey = QStringLiteral("location/enabled");
-    const QString LocationSettingsMlsEnabledKey = QStringLiteral("location/mls/enabled");
-    const QString LocationSettingsMlsOnlineEnabledKey = QStringLiteral("location/mls/online_enabled");
-    const QString LocationSettingsOldMlsEnabledKey = QStringLiteral("location/cell_id_positioning_enabled"); // deprecated key
-    const QString LocationSettingsDataSourceOnlineAllowedKey = QStringLiteral("location/allowed_data_sources/online");
-    const QString LocationSettingsDataSourceCellDataAllowedKey = QStringLiteral("location/allowed_data_sources/cell_data");
-    const QString LocationSettingsDataSourceWlanDataAllowedKey = QStringLiteral("location/allowed_data_sources/wlan_data");
+    const quint32 SignalStrengthStep = 4;       // signal strength changes within the same step don't trigger a new estimate.
+    const qint64 StaleLocationMaxAge = 3600000; // 1h, the oldest position from before a restart handed out until a new one is calculated
+    const int FixTimeout = 30000;               // 30s, status will change from Available to Acquiring if no position can be calculated in this time after the cells or wlan change.
+    const quint32 MinimumInterval = 10000;      // 10s, the shortest interval at which the plugin will emit position updates
+    const int CoalesceInterval = 100;           // 100ms, cell and wlan changes arriving within this time cause only one recalculation
+    const int LatencyProbeInterval = 10;        // 10ms, how often the responsiveness of the main loop is sampled during cell lookups, if enabled
+    const int DefaultTimerSlack = 1000;         // 1s, timers are aligned to this, unless set with GEOCLUE_MLSDB_TIMER_SLACK (msecs)
+    const int ScreenOffSlackFactor = 10;        // the timer slack is this many times larger while the screen is off
+    const int ScreenOffCoalesceInterval = 5000; // 5s, CoalesceInterval while the screen is off
+    const quint32 ScreenOffInterval = 60000;    // 60s, the shortest interval at which position updates are emitted while the screen is off
 }
 
 QDBusArgument &operator<<(QDBusArgument &argument, const Accuracy &accuracy)
@@ -81,16 +79,22 @@ const QDBusArgument &operator>>(const QDBusArgument &argument, Accuracy &accurac
 MlsdbProvider::MlsdbProvider(QObject *parent)
 :   QObject(parent),
     m_positioningEnabled(false),
-    m_cellDataAllowed(false),
     m_positioningStarted(false),
+    m_initialized(false),
     m_status(StatusUnavailable),
+    m_currentLocationStale(false),
     m_mlsdbOnlineLocator(0),
-    m_onlinePositioningEnabled(false),
-    m_onlineDataAllowed(false),
-    m_wlanDataAllowed(false),
+    m_skippedOnlineQueries(0),
     m_cellWatcher(Q_NULLPTR),
-    m_signalUpdateCell(false),
-    m_signalUpdateWlan(false)
+    m_snapshot(new MlsdbSnapshot),
+    m_dataStamp(0),
+    m_cellLocator(new MlsdbCellLocator(m_snapshot)),
+    m_cellsFingerprint(0),
+    m_requestedFingerprint(0),
+    m_estimatePending(false),
+    m_longestStall(0),
+    m_timerSlack(DefaultTimerSlack),
+    m_screenOff(false)
 {
     if (staticProvider)
         qFatal("Only a single instance of MlsdbProvider is supported.");
@@ -98,22 +102,25 @@ MlsdbProvider::MlsdbProvider(QObject *parent)
     qRegisterMetaType<Location>();
     qDBusRegisterMetaType<Accuracy>();
 
+    bool ok = false;
+    const int timerSlack = qEnvironmentVariableIntValue("GEOCLUE_MLSDB_TIMER_SLACK", &ok);
+    if (ok && timerSlack >= 0)
+        m_timerSlack = timerSlack;
+
     staticProvider = this;
 
-    connect(&m_locationSettingsWatcher, &QFileSystemWatcher::fileChanged,
-            this, &MlsdbProvider::updatePositioningEnabled);
-    connect(&m_locationSettingsWatcher, &QFileSystemWatcher::directoryChanged,
-            this, &MlsdbProvider::updatePositioningEnabled);
-    m_locationSettingsWatcher.addPath(LocationSettingsDir);
-    m_locationSettingsWatcher.addPath(LocationSettingsFile);
-    updatePositioningEnabled();
+    // Cell lookups read the data files, which may be slow on a cold cache,
+    // so they are kept away from the thread serving D-Bus.
+    m_cellLocator->moveToThread(&m_cellLocatorThread);
+    connect(m_cellLocator, &MlsdbCellLocator::locationEstimated,
+            this, &MlsdbProvider::cellLocationEstimated);
 
     new GeoclueAdaptor(this);
     new PositionAdaptor(this);
 
     qCDebug(lcGeoclueMlsdb) << "Mozilla Location Services geoclue plugin active";
     if (m_watchedServices.isEmpty()) {
-        m_idleTimer.start(QuitIdleTime, this);
+        startIdleTimer();
     }
 
     QDBusConnection connection = QDBusConnection::sessionBus();
@@ -123,8 +130,59 @@ MlsdbProvider::MlsdbProvider(QObject *parent)
     connect(m_watcher, &QDBusServiceWatcher::serviceUnregistered,
             this, &MlsdbProvider::serviceUnregistered);
 
+    // Everything else waits until the object is on the bus, see initialize().
+    QMetaObject::invokeMethod(this, "initialize", Qt::QueuedConnection);
+}
+
+/*
+    The parts of the provider which aren't needed to be registered on the
+    bus are set up here, once the event loop is running, or as soon as a
+    D-Bus method needs them, whichever comes first.
+*/
+void MlsdbProvider::initialize()
+{
+    if (m_initialized)
+        return;
+    m_initialized = true;
+
+    // Pick up from where the previous instance left off before quitting.
+    m_dataStamp = MlsdbSnapshot::dataStamp(MlsdbCellLocator::dataDirectory());
+    m_snapshot->map(MlsdbSnapshot::defaultPath(), m_dataStamp);
+    mlsdbStartupTrace("snapshot mapped");
+
+    m_idlePolicy.setActivationTimes(m_snapshot->activationTimes());
+    if (m_idleTimer.isActive()) {
+        startIdleTimer();
+    }
+
+    m_cellLocatorThread.start();
+    mlsdbStartupTrace("cell locator thread started");
+
+    connect(&m_settings, &MlsdbSettingsWatcher::changed,
+            this, &MlsdbProvider::updatePositioningEnabled);
+    m_settings.start();
+    updatePositioningEnabled(MlsdbLocationSettings::AllFields);
+    mlsdbStartupTrace("settings read");
+
+    QDBusConnection systemBus = QDBusConnection::systemBus();
+    systemBus.connect(QStringLiteral("com.nokia.mce"), QStringLiteral("/com/nokia/mce/signal"),
+                      QStringLiteral("com.nokia.mce.signal"), QStringLiteral("display_status_ind"),
+                      this, SLOT(displayStatusChanged(QString)));
+    QDBusPendingCallWatcher *displayStatus = new QDBusPendingCallWatcher(systemBus.asyncCall(
+            QDBusMessage::createMethodCall(QStringLiteral("com.nokia.mce"), QStringLiteral("/com/nokia/mce/request"),
+                                           QStringLiteral("com.nokia.mce.request"), QStringLiteral("get_display_status"))),
+            this);
+    connect(displayStatus, &QDBusPendingCallWatcher::finished,
+            this, &MlsdbProvider::displayStatusReceived);
+
     if (m_positioningEnabled) {
-        cellularNetworkRegistrationChanged();
+        const Location lastLocation = m_snapshot->lastLocation();
+        if (lastLocation.timestamp() != 0
+                && QDateTime::currentMSecsSinceEpoch() - lastLocation.timestamp() < StaleLocationMaxAge) {
+            m_currentLocation = lastLocation;
+            m_publishedLocation.store(m_currentLocation);
+            m_currentLocationStale = true;
+        }
     } else {
         qCDebug(lcGeoclueMlsdb) << "positioning is not currently enabled, idling";
     }
@@ -132,74 +190,24 @@ MlsdbProvider::MlsdbProvider(QObject *parent)
 
 MlsdbProvider::~MlsdbProvider()
 {
+    m_cellLocatorThread.quit();
+    m_cellLocatorThread.wait();
+    delete m_cellLocator;
+    delete m_snapshot;
+
     if (staticProvider == this)
         staticProvider = 0;
 }
 
-// TODO: Search alternative locations for files with mlsdb data
-bool MlsdbProvider::searchForCellIdLocation(quint64 uniqueCellId, MlsdbCoords *coords)
-{
-    if (uniqueCellId == 0) {
-        return false;
-    }
-    QString datfile = "/usr/share/geoclue-provider-mlsdb/data/";
-    quint16 mcc = getCellMcc(uniqueCellId);
-    datfile.append(QString::number(mcc));
-    datfile.append(".dat");
-    FILE *fileptr = fopen(datfile.toStdString().c_str(), "r");
-    if (fileptr == NULL) {
-        fprintf(stderr, "WARNING: Unable to open data file for mcc %d\n", mcc);
-        return false;
-    }
-    fseek(fileptr, 0, SEEK_END);
-    size_t filesize = ftell(fileptr);
-    if (filesize % (2 * DATA_SIZE) != 0) {
-        fprintf(stderr, "ERROR: File size is not a multiple of data size. Corrupt file?\n");
-        return false;
-    }
-    size_t pos = filesize / 4; // Halfway through network data (== first half) of file
-    if (pos % DATA_SIZE != 0) {
-        pos -= DATA_SIZE / 2;
-    }
-    size_t half = pos;
-    size_t old_pos = 1, old_pos2 = 1;
-    quint64 network = 0;
-    quint64 uid = uniqueCellId & 0xFFFFFFFFFFFFFF;
-    while (uid != network) {
-        if (old_pos == pos || old_pos2 == pos) {
-            fprintf(stderr, "WARNING: Could not find exact record. Target is %llu, closest match is %llu\n", uid, network);
-            return false;
-        }
-        old_pos2 = old_pos;
-        old_pos = pos;
-        fseek(fileptr, pos, SEEK_SET);
-        fread(&network, DATA_SIZE, 1, fileptr);
-        half /= 2;
-        if (half % DATA_SIZE != 0) {
-            half -= DATA_SIZE / 2;
-            if (half == 0) {
-                half = DATA_SIZE;
-            }
-        }
-        if (uid > network) {
-            pos += half;
-        }
-        else if (uid < network) {
-            pos -= half;
-        }
-    }
-    fseek(fileptr, pos + (filesize / 2), SEEK_SET); // Jump to location data (== 2nd half)
-    fread(&(coords->lat), DATA_SIZE / 2, 1, fileptr);
-    fread(&(coords->lon), DATA_SIZE / 2, 1, fileptr);
-    fclose(fileptr);
-    return true;
-}
-
 void MlsdbProvider::AddReference()
 {
     if (!calledFromDBus())
         qFatal("AddReference must only be called from DBus");
 
+    mlsdbStartupTrace("AddReference");
+    m_wakeups.count(MlsdbWakeupCounter::DBusCall);
+    initialize();
+
     bool wasInactive = m_watchedServices.isEmpty();
     const QString service = message().service();
     m_watcher->addWatchedService(service);
@@ -207,8 +215,14 @@ void MlsdbProvider::AddReference()
     if (wasInactive) {
         qCDebug(lcGeoclueMlsdb) << "new watched service, stopping idle timer.";
         m_idleTimer.stop();
+        m_idlePolicy.activated(QDateTime::currentMSecsSinceEpoch());
     }
 
+    if (m_positioningStarted && m_watchedServices[service].referenceCount == 1
+            && m_currentLocation.timestamp() != 0) {
+        // the new client doesn't have the position yet, even if nothing has changed since.
+        scheduleLocationEmission();
+    }
     startPositioningIfNeeded();
 }
 
@@ -217,6 +231,8 @@ void MlsdbProvider::RemoveReference()
     if (!calledFromDBus())
         qFatal("RemoveReference must only be called from DBus");
 
+    m_wakeups.count(MlsdbWakeupCounter::DBusCall);
+
     const QString service = message().service();
 
     if (m_watchedServices[service].referenceCount > 0)
@@ -229,7 +245,7 @@ void MlsdbProvider::RemoveReference()
 
     if (m_watchedServices.isEmpty()) {
         qCDebug(lcGeoclueMlsdb) << "no watched services, starting idle timer.";
-        m_idleTimer.start(QuitIdleTime, this);
+        startIdleTimer();
     }
 
     stopPositioningIfNeeded();
@@ -243,6 +259,7 @@ QString MlsdbProvider::GetProviderInfo(QString &description)
 
 int MlsdbProvider::GetStatus()
 {
+    initialize();
     return m_status;
 }
 
@@ -251,114 +268,213 @@ void MlsdbProvider::SetOptions(const QVariantMap &options)
     if (!calledFromDBus())
         qFatal("SetOptions must only be called from DBus");
 
+    m_wakeups.count(MlsdbWakeupCounter::DBusCall);
+
     const QString service = message().service();
     if (!m_watchedServices.contains(service)) {
         qWarning("Only active users can call SetOptions");
         return;
     }
 
+    // in metres. When every client has set this, and the offline estimate is at least
+    // as accurate, the online service isn't queried.
+    if (options.contains(QStringLiteral("RequiredAccuracy"))) {
+        m_watchedServices[service].requiredAccuracy =
+            options.value(QStringLiteral("RequiredAccuracy")).toUInt();
+    }
+
     if (options.contains(QStringLiteral("UpdateInterval"))) {
         m_watchedServices[service].updateInterval =
             options.value(QStringLiteral("UpdateInterval")).toUInt();
 
-        quint32 updateInterval = minimumRequestedUpdateInterval();
-        m_recalculatePositionTimer.start(updateInterval, this);
+        // A pending update is due at a different time now.
+        if (m_emitTimer.isActive()) {
+            m_emitTimer.stop();
+            scheduleLocationEmission();
+        }
+        startRepeatTimer();
     }
 }
 
 int MlsdbProvider::GetPosition(int &timestamp, double &latitude, double &longitude,
                                 double &altitude, Accuracy &accuracy)
 {
-    if (m_currentLocation.timestamp() > 0) {
+    mlsdbStartupTrace("GetPosition");
+    m_wakeups.count(MlsdbWakeupCounter::DBusCall);
+    initialize();
+
+    const Location location = m_publishedLocation.load();
+    if (location.timestamp() > 0) {
         qCDebug(lcGeoclueMlsdbPosition) << "GetPosition:"
-                                        << "timestamp:" << m_currentLocation.timestamp()
-                                        << "latitude:" << m_currentLocation.latitude()
-                                        << "longitude:" << m_currentLocation.longitude()
-                                        << "accuracy:" << m_currentLocation.accuracy().horizontal();
+                                        << "timestamp:" << location.timestamp()
+                                        << "latitude:" << location.latitude()
+                                        << "longitude:" << location.longitude()
+                                        << "accuracy:" << location.accuracy().horizontal();
     } else {
         qCDebug(lcGeoclueMlsdbPosition) << "GetPosition: no valid current location known";
     }
 
-    PositionFields positionFields = NoPositionFields;
+    timestamp = location.timestamp() / 1000;
+    latitude = location.latitude();
+    longitude = location.longitude();
+    altitude = location.altitude();
+    accuracy = location.accuracy();
 
-    timestamp = m_currentLocation.timestamp() / 1000;
-    if (!qIsNaN(m_currentLocation.latitude()))
-        positionFields |= LatitudePresent;
-    latitude = m_currentLocation.latitude();
-    if (!qIsNaN(m_currentLocation.longitude()))
-        positionFields |= LongitudePresent;
-    longitude = m_currentLocation.longitude();
-    if (!qIsNaN(m_currentLocation.altitude()))
-        positionFields |= AltitudePresent;
-    altitude = m_currentLocation.altitude();
-    accuracy = m_currentLocation.accuracy();
-
-    return positionFields;
+    return positionFields(location);
 }
 
 void MlsdbProvider::timerEvent(QTimerEvent *event)
 {
     if (event->timerId() == m_idleTimer.timerId()) {
         m_idleTimer.stop();
+        m_wakeups.count(MlsdbWakeupCounter::IdleTimer);
         qCDebug(lcGeoclueMlsdb) << "have been idle for too long, quitting";
+        m_idlePolicy.quitting(QDateTime::currentMSecsSinceEpoch());
+        m_wakeups.report();
+        writeSnapshot();
         qApp->quit();
     } else if (event->timerId() == m_fixLostTimer.timerId()) {
         m_fixLostTimer.stop();
+        m_wakeups.count(MlsdbWakeupCounter::FixLostTimer);
         setStatus(StatusAcquiring);
     } else if (event->timerId() == m_recalculatePositionTimer.timerId()) {
-        const qint64 currTimestamp = QDateTime::currentMSecsSinceEpoch();
-        if (!m_positioningEnabled) {
-            qCDebug(lcGeoclueMlsdb) << "positioning is disabled, preventing MLS calculation";
-        } else if (m_currentLocation.timestamp() == 0
-                || ((currTimestamp - m_currentLocation.timestamp()) > ReuseInterval)
-                || m_signalUpdateCell || m_signalUpdateWlan) {
-            qCDebug(lcGeoclueMlsdb) << "calculating new position information";
-            m_signalUpdateCell = false;
-            m_signalUpdateWlan = false;
-            calculatePositionAndEmitLocation();
-        } else {
-            qCDebug(lcGeoclueMlsdb) << "re-using old position information";
-            setLocation(m_currentLocation);
-        }
+        m_recalculatePositionTimer.stop();
+        m_wakeups.count(MlsdbWakeupCounter::RecalculationTimer);
+        qCDebug(lcGeoclueMlsdb) << "calculating new position information";
+        calculatePositionAndEmitLocation();
+    } else if (event->timerId() == m_emitTimer.timerId()) {
+        m_emitTimer.stop();
+        m_wakeups.count(MlsdbWakeupCounter::EmissionTimer);
+        emitLocationChanged();
+    } else if (event->timerId() == m_repeatTimer.timerId()) {
+        m_repeatTimer.stop();
+        m_wakeups.count(MlsdbWakeupCounter::RepeatTimer);
+        scheduleRecalculation();
+    } else if (event->timerId() == m_latencyProbeTimer.timerId()) {
+        m_wakeups.count(MlsdbWakeupCounter::LatencyProbeTimer);
+        m_longestStall = qMax(m_longestStall, m_latencyProbeClock.restart() - LatencyProbeInterval);
     } else {
         QObject::timerEvent(event);
     }
 }
 
+/*
+    The offline estimate from the cells is always calculated, and emitted as
+    soon as it is known, which is usually well before a reply to the online
+    query arrives. The online position then replaces it if it is better,
+    see updateLocationFromEstimate().
+*/
 void MlsdbProvider::calculatePositionAndEmitLocation()
 {
-    const QList<CellPositioningData> cellIds = seenCellIds();
-    if (m_onlinePositioningEnabled) {
-        if (!m_mlsdbOnlineLocator) {
-            m_mlsdbOnlineLocator = new MlsdbOnlineLocator(this);
-            m_mlsdbOnlineLocator->setWlanDataAllowed(m_wlanDataAllowed);
-            connect(m_mlsdbOnlineLocator, &MlsdbOnlineLocator::wlanChanged,
-                    this, &MlsdbProvider::onlineWlanChanged);
-            connect(m_mlsdbOnlineLocator, &MlsdbOnlineLocator::locationFound,
-                    this, &MlsdbProvider::onlineLocationFound);
-            connect(m_mlsdbOnlineLocator, &MlsdbOnlineLocator::error,
-                    this, &MlsdbProvider::onlineLocationError);
-        }
-        const QPair<QDateTime, QVariantMap> query = m_mlsdbOnlineLocator->buildLocationQuery(
-                cellIds, m_previousQuery);
-        if (m_mlsdbOnlineLocator->findLocation(query)) {
-            m_previousQuery = query;
-            return;
+    updateLocationFromCells(seenCellIds());
+}
+
+/*
+    Called once the offline estimate for the current cells is known. The
+    network is only used if it can improve on the estimate: when all clients
+    have set a RequiredAccuracy which the estimate meets already, there is
+    no online query.
+*/
+void MlsdbProvider::queryOnlineLocation(const Location &offlineEstimate)
+{
+    if (!m_settings.settings().onlinePositioningEnabled)
+        return;
+
+    const quint32 accuracy = requiredAccuracy();
+    if (accuracy != 0 && offlineEstimate.timestamp() != 0
+            && offlineEstimate.accuracy().horizontal() <= accuracy) {
+        ++m_skippedOnlineQueries;
+        qCDebug(lcGeoclueMlsdbOnline) << "offline estimate is accurate to" << offlineEstimate.accuracy().horizontal()
+                                      << "m, which is enough for" << accuracy << "m, skipping online query"
+                                      << m_skippedOnlineQueries;
+        return;
+    }
+
+    if (!m_mlsdbOnlineLocator) {
+        m_mlsdbOnlineLocator = new MlsdbOnlineLocator(this);
+        m_mlsdbOnlineLocator->setWlanDataAllowed(m_settings.settings().wlanDataAllowed);
+        connect(m_mlsdbOnlineLocator, &MlsdbOnlineLocator::wlanChanged,
+                this, &MlsdbProvider::onlineWlanChanged);
+        connect(m_mlsdbOnlineLocator, &MlsdbOnlineLocator::locationFound,
+                this, &MlsdbProvider::onlineLocationFound);
+        connect(m_mlsdbOnlineLocator, &MlsdbOnlineLocator::error,
+                this, &MlsdbProvider::onlineLocationError);
+        connect(m_mlsdbOnlineLocator, &MlsdbOnlineLocator::replyTimedOut,
+                this, &MlsdbProvider::onlineReplyTimedOut);
+
+        const MlsdbSnapshot::OnlineState onlineState = m_snapshot->onlineState();
+        m_mlsdbOnlineLocator->setBackOffState(onlineState);
+        if (m_previousQuery.first.isNull() && onlineState.lastQueryTime != 0) {
+            // only the time matters, for throttling.
+            m_previousQuery.first = QDateTime::fromMSecsSinceEpoch(onlineState.lastQueryTime).toUTC();
         }
     }
+    const QPair<QDateTime, QVariantMap> query = m_mlsdbOnlineLocator->buildLocationQuery(
+            m_seenCells, m_previousQuery);
+    if (m_mlsdbOnlineLocator->findLocation(query)) {
+        m_previousQuery = query;
+    }
+}
+
+void MlsdbProvider::writeSnapshot()
+{
+    // the caches of the cell locator can only be read while its thread is stopped.
+    m_cellLocatorThread.quit();
+    m_cellLocatorThread.wait();
 
-    // fall back to using offline position
-    updateLocationFromCells(cellIds);
+    MlsdbSnapshot::OnlineState onlineState = m_snapshot->onlineState();
+    if (m_mlsdbOnlineLocator) {
+        const qint64 lastQueryTime = onlineState.lastQueryTime;
+        onlineState = m_mlsdbOnlineLocator->backOffState();
+        onlineState.lastQueryTime = m_previousQuery.first.isNull()
+                                  ? lastQueryTime
+                                  : m_previousQuery.first.toMSecsSinceEpoch();
+    }
+    MlsdbSnapshot::write(MlsdbSnapshot::defaultPath(), m_dataStamp, m_currentLocation, onlineState,
+                         m_idlePolicy.activationTimes(),
+                         m_cellLocator->cache(), m_snapshot);
+}
+
+void MlsdbProvider::startIdleTimer()
+{
+    const int timeout = m_idlePolicy.idleTimeout();
+    qCDebug(lcGeoclueMlsdb) << "quitting if idle for" << timeout / 1000 << "s";
+    m_idlePolicy.idleStarted(QDateTime::currentMSecsSinceEpoch());
+    startCoarseTimer(m_idleTimer, timeout);
+}
+
+/*
+    Rather than expiring exactly after interval, the timer expires at the
+    next multiple of the timer slack on the monotonic clock. Timers due
+    within the same slack then expire together, with a single wakeup.
+*/
+void MlsdbProvider::startCoarseTimer(QBasicTimer &timer, int interval)
+{
+    const qint64 slack = m_screenOff ? qint64(m_timerSlack) * ScreenOffSlackFactor : m_timerSlack;
+    if (slack > 0) {
+        QElapsedTimer clock;
+        clock.start();
+        const qint64 now = clock.msecsSinceReference();
+        interval = (now + interval + slack - 1) / slack * slack - now;
+    }
+    timer.start(interval, Qt::CoarseTimer, this);
 }
 
 void MlsdbProvider::onlineWlanChanged()
 {
-    m_signalUpdateWlan = true;
+    m_wakeups.count(MlsdbWakeupCounter::WlanChange);
+    scheduleRecalculation();
+}
+
+void MlsdbProvider::onlineReplyTimedOut()
+{
+    m_wakeups.count(MlsdbWakeupCounter::OnlineReplyTimer);
 }
 
 void MlsdbProvider::onlineLocationFound(double latitude, double longitude, double accuracy)
 {
     qCDebug(lcGeoclueMlsdbPosition) << "Location from MLS online:" << latitude << longitude << accuracy;
+    mlsdbStartupTrace("online position received");
 
     Location deviceLocation;
     deviceLocation.setTimestamp(QDateTime::currentMSecsSinceEpoch());
@@ -369,28 +485,31 @@ void MlsdbProvider::onlineLocationFound(double latitude, double longitude, doubl
     positionAccuracy.setHorizontal(accuracy);
     deviceLocation.setAccuracy(positionAccuracy);
 
-    setLocation(deviceLocation);
+    // only if it refines the offline estimate, or that is getting old.
+    updateLocationFromEstimate(deviceLocation);
 }
 
 void MlsdbProvider::onlineLocationError(const QString &errorString)
 {
+    // the offline estimate has been emitted already, and stays.
     qCDebug(lcGeoclueMlsdbPosition) << "Cannot fetch position from online source:" << errorString
-                                    << ", falling back to offline source";
-
-    // fall back to using offline position
-    updateLocationFromCells(seenCellIds());
+                                    << ", keeping position from offline source";
 }
 
-QList<MlsdbProvider::CellPositioningData> MlsdbProvider::seenCellIds() const
+/*
+    The cells are collected into m_seenCells, which has room for more cells
+    than a modem reports. There are only a handful of cells, so duplicates
+    are looked for linearly.
+*/
+const MlsdbSeenCells &MlsdbProvider::seenCellIds()
 {
-    QList<CellPositioningData> cells;
-    if (!m_cellDataAllowed) {
-        return cells;
+    m_seenCells.clear();
+    if (!m_settings.settings().cellDataAllowed || !m_cellWatcher) {
+        return m_seenCells;
     }
 
     qCDebug(lcGeoclueMlsdbPosition) << "have" << m_cellWatcher->cells().size() << "neighbouring cells";
     quint32 maxNeighborSignalStrength = 1;
-    QSet<quint64> seenCellIds;
     Q_FOREACH (const QSharedPointer<QOfonoExtCell> &c, m_cellWatcher->cells()) {
         CellPositioningData cell;
         quint32 locationCode = 0;
@@ -421,7 +540,7 @@ QList<MlsdbProvider::CellPositioningData> MlsdbProvider::seenCellIds() const
             continue;
         }
         cell.uniqueCellId = getMlsdbUniqueCellId(cellType, cellId, locationCode, mcc, mnc);
-        if (!seenCellIds.contains(cell.uniqueCellId)) {
+        if (!m_seenCells.contains(cell.uniqueCellId)) {
             qCDebug(lcGeoclueMlsdbPosition) << "have neighbour cell: " << cell.uniqueCellId
                                             << "with strength:" << c->signalStrength();
             cell.signalStrength = c->signalStrength();
@@ -432,98 +551,100 @@ QList<MlsdbProvider::CellPositioningData> MlsdbProvider::seenCellIds() const
                 // strongest of our neighbor cells.
                 maxNeighborSignalStrength = cell.signalStrength;
             }
-            cells.append(cell);
-            seenCellIds.insert(cell.uniqueCellId);
-        }
-    }
-    return cells;
-}
-
-void MlsdbProvider::updateLocationFromCells(const QList<CellPositioningData> &cells)
-{
-    // determine which cells we have an accurate location for, from MLSDB data.
-    double totalSignalStrength = 0.0;
-    QMap<quint64, MlsdbCoords> cellLocations;
-    Q_FOREACH (const CellPositioningData &cell, cells) {
-        MlsdbCoords cellCoords;
-        if (!m_uniqueCellIdToLocation.contains(cell.uniqueCellId)) {
-            if (m_knownCellIdsWithUnknownLocations.contains(cell.uniqueCellId)) {
-                // we know that we don't know the location of this cellId.  Skip it.
-                continue;
-            } else {
-                // this is a new cell Id that we haven't encountered yet.  Probe it.
-                if (!searchForCellIdLocation(cell.uniqueCellId, &cellCoords)) {
-                    // we now know that we don't know the location of this cellId.
-                    m_knownCellIdsWithUnknownLocations.insert(cell.uniqueCellId);
-                    continue;
-                }
-                // cache the location of the cell id for future reference.
-                m_uniqueCellIdToLocation.insert(cell.uniqueCellId, cellCoords);
+            if (!m_seenCells.append(cell)) {
+                qCDebug(lcGeoclueMlsdbPosition) << "ignoring cells beyond the first" << m_seenCells.size();
+                break;
             }
-        } else {
-            cellCoords = m_uniqueCellIdToLocation.value(cell.uniqueCellId);
         }
-        // we have a known location for this cell.  Update our locations list.
-        cellLocations.insert(cell.uniqueCellId, cellCoords);
-        totalSignalStrength += (1.0 * cell.signalStrength);
     }
+    return m_seenCells;
+}
 
-    if (cellLocations.size() == 0) {
-        qCDebug(lcGeoclueMlsdbPosition) << "no cell id data to calculate position from";
-        return;
-    } else if (cellLocations.size() == 1) {
-        qCDebug(lcGeoclueMlsdbPosition) << "only one cell id datum to calculate position from, position will be extremely inaccurate";
-    } else if (cellLocations.size() == 2) {
-        qCDebug(lcGeoclueMlsdbPosition) << "only two cell id data to calculate position from, position will be highly inaccurate";
-    } else {
-        qCDebug(lcGeoclueMlsdbPosition) << "calculating position from" << cellLocations.size() << "cell id data";
-    }
-
-    // now use the current cell and neighboringcell information to triangulate our position.
-    double deviceLatitude = 0.0;
-    double deviceLongitude = 0.0;
-    Q_FOREACH (const CellPositioningData &cell, cells) {
-        if (cellLocations.contains(cell.uniqueCellId)) {
-            const MlsdbCoords &cellCoords(cellLocations.value(cell.uniqueCellId));
-            double weight = (((double)cell.signalStrength) / totalSignalStrength);
-            deviceLatitude += (weight * cellCoords.lat);
-            deviceLongitude += (weight * cellCoords.lon);
-            qCDebug(lcGeoclueMlsdbPosition) << "have cell: " << cell.uniqueCellId
-                                            << "with position: " << cellCoords.lat << "," << cellCoords.lon
-                                            << "with strength: " << ((double)cell.signalStrength / totalSignalStrength);
+/*
+    An order independent fingerprint of the cells and their signal strengths,
+    with the strengths quantized so that small fluctuations are ignored.
+*/
+quint64 MlsdbProvider::cellsFingerprint(const MlsdbSeenCells &cells)
+{
+    quint64 fingerprint = cells.size();
+    for (const CellPositioningData &cell : cells) {
+        // splitmix64 finalizer, so that the sum doesn't cancel out similar ids.
+        quint64 z = cell.uniqueCellId ^ (quint64(cell.signalStrength / SignalStrengthStep) << 56);
+        z = (z ^ (z >> 30)) * Q_UINT64_C(0xBF58476D1CE4E5B9);
+        z = (z ^ (z >> 27)) * Q_UINT64_C(0x94D049BB133111EB);
+        fingerprint += z ^ (z >> 31);
+    }
+    return fingerprint;
+}
+
+void MlsdbProvider::updateLocationFromCells(const MlsdbSeenCells &cells)
+{
+    // the estimate only depends on the cells, so it can be reused until they change.
+    const quint64 fingerprint = cellsFingerprint(cells);
+    if (m_cellsEstimate.timestamp() != 0 && fingerprint == m_cellsFingerprint) {
+        qCDebug(lcGeoclueMlsdbPosition) << "cells have not changed, re-using previous estimate";
+        Location deviceLocation = m_cellsEstimate;
+        deviceLocation.setTimestamp(QDateTime::currentMSecsSinceEpoch());
+        // the same estimate again adds nothing to the filtered position, and the device
+        // evidently hasn't moved, so the position is only brought up to date, and emitted
+        // no more often than clients asked for.
+        const Location held = m_positionFilter.hold(deviceLocation.timestamp());
+        if (held.timestamp() != 0) {
+            setLocation(held);
         } else {
-            qCDebug(lcGeoclueMlsdbPosition) << "do not know position of cell with id: " << cell.uniqueCellId;
+            updateLocationFromEstimate(deviceLocation);
+        }
+        queryOnlineLocation(deviceLocation);
+    } else if (m_estimatePending && fingerprint == m_requestedFingerprint) {
+        qCDebug(lcGeoclueMlsdbPosition) << "estimate for these cells is already being calculated";
+    } else {
+        m_requestedFingerprint = fingerprint;
+        m_estimatePending = true;
+        m_estimateClock.start();
+        if (lcGeoclueMlsdbLatency().isDebugEnabled()) {
+            m_longestStall = 0;
+            m_latencyProbeClock.start();
+            m_latencyProbeTimer.start(LatencyProbeInterval, this);
         }
+        m_cellLocator->requestEstimate(fingerprint, cells);
     }
+}
 
-    Location deviceLocation;
-    if (cellLocations.size()) {
-        // estimate accuracy based on how many cells we have.
-        Accuracy positionAccuracy;
-        positionAccuracy.setHorizontal(qMax(MinimumCalculatedAccuracy,
-                                            10000 - (1000 * cellLocations.size())));
-        deviceLocation.setTimestamp(QDateTime::currentMSecsSinceEpoch());
-        deviceLocation.setLatitude(deviceLatitude);
-        deviceLocation.setLongitude(deviceLongitude);
-        deviceLocation.setAccuracy(positionAccuracy);
-    }
-
-    // and set this as our location if it is at least as accurate as our previous data,
-    // or if the previous data is more than two minutes old.
-    if (m_currentLocation.timestamp() != 0
-            && (QDateTime::currentMSecsSinceEpoch() - m_currentLocation.timestamp()) < FallbackInterval
-            && m_currentLocation.accuracy().horizontal() < deviceLocation.accuracy().horizontal()) {
-        qCDebug(lcGeoclueMlsdb) << "re-using old position information due to better accuracy";
-        qCDebug(lcGeoclueMlsdb) << "preferring:" << m_currentLocation.latitude() << ","
-                                                 << m_currentLocation.longitude() << ","
-                                                 << m_currentLocation.accuracy().horizontal()
-                                << "over:" << deviceLocation.latitude() << ","
-                                           << deviceLocation.longitude() << ","
-                                           << deviceLocation.accuracy().horizontal();
-        setLocation(m_currentLocation);
-    } else {
-        setLocation(deviceLocation);
+void MlsdbProvider::cellLocationEstimated(quint64 fingerprint, const Location &location)
+{
+    mlsdbStartupTrace("cell estimate received");
+    m_cellsFingerprint = fingerprint;
+    m_cellsEstimate = location;
+    if (fingerprint != m_requestedFingerprint) {
+        return; // the cells have changed again, a newer estimate is on its way.
+    }
+    m_estimatePending = false;
+    if (m_latencyProbeTimer.isActive()) {
+        m_latencyProbeTimer.stop();
+        qCDebug(lcGeoclueMlsdbLatency) << "cell lookup took" << m_estimateClock.elapsed() << "ms,"
+                                       << "longest main loop stall meanwhile" << m_longestStall << "ms";
+    }
+    if (!m_positioningStarted) {
+        return;
+    }
+    if (location.timestamp() != 0) {
+        updateLocationFromEstimate(location);
     }
+    queryOnlineLocation(location);
+}
+
+void MlsdbProvider::updateLocationFromEstimate(const Location &deviceLocation)
+{
+    // an estimate less accurate than the previous ones only moves the position a little.
+    const Location location = m_positionFilter.update(deviceLocation);
+    qCDebug(lcGeoclueMlsdbPosition) << "filtered:" << deviceLocation.latitude() << ","
+                                                   << deviceLocation.longitude() << ","
+                                                   << deviceLocation.accuracy().horizontal()
+                                    << "to:" << location.latitude() << ","
+                                             << location.longitude() << ","
+                                             << location.accuracy().horizontal()
+                                    << "speed:" << location.speed() << "direction:" << location.direction();
+    setLocation(location);
 }
 
 void MlsdbProvider::setLocation(const Location &location)
@@ -533,17 +654,23 @@ void MlsdbProvider::setLocation(const Location &location)
                                     << "lat:" << location.latitude() << "," << "lon:" << location.longitude() << ","
                                     << "accuracy:" << location.accuracy().horizontal();
 
+    m_currentLocationStale = false;
     if (location.timestamp() != 0) {
         setStatus(StatusAvailable);
-        m_fixLostTimer.start(FixTimeout, this);
+        m_fixLostTimer.stop();
         m_lastLocation = m_currentLocation;
+        m_currentLocation = location;
+        m_publishedLocation.store(m_currentLocation);
+        scheduleLocationEmission();
     } else {
         qCDebug(lcGeoclueMlsdbPosition) << "location invalid, lost positioning fix";
         m_lastLocation = Location(); // lost fix, reset last location also.
+        m_positionFilter.reset();
+        m_currentLocation = location;
+        m_publishedLocation.store(m_currentLocation);
+        m_emitTimer.stop();
+        emitLocationChanged();
     }
-
-    m_currentLocation = location;
-    emitLocationChanged();
 }
 
 void MlsdbProvider::serviceUnregistered(const QString &service)
@@ -552,77 +679,65 @@ void MlsdbProvider::serviceUnregistered(const QString &service)
     m_watcher->removeWatchedService(service);
     if (m_watchedServices.isEmpty()) {
         qCDebug(lcGeoclueMlsdb) << "no watched services, starting idle timer.";
-        m_idleTimer.start(QuitIdleTime, this);
+        startIdleTimer();
     }
 
     stopPositioningIfNeeded();
 }
 
-void MlsdbProvider::updatePositioningEnabled()
+void MlsdbProvider::updatePositioningEnabled(MlsdbLocationSettings::Fields fields)
 {
-    bool positioningEnabled = false;
-    bool cellPositioningEnabled = false;
-
-    bool onlineDataAllowed = false;
-    bool cellDataAllowed = false;
-    bool wlanDataAllowed = false;
-
-    getEnabled(&positioningEnabled,
-               &cellPositioningEnabled,
-               &m_onlinePositioningEnabled,
-               &onlineDataAllowed,
-               &cellDataAllowed,
-               &wlanDataAllowed);
-
-    qCDebug(lcGeoclueMlsdb) << "positioning is" << (positioningEnabled ? "enabled" : "disabled");
-    qCDebug(lcGeoclueMlsdb) << "device-local cell triangulation positioning is" << (cellPositioningEnabled ? "enabled" : "disabled");
-    qCDebug(lcGeoclueMlsdb) << "mls online service positioning is" << (m_onlinePositioningEnabled ? "enabled" : "disabled");
-
-    qCDebug(lcGeoclueMlsdb) << "now checking MDM data source restrictions...";
+    const MlsdbLocationSettings &settings = m_settings.settings();
 
-    if (m_onlineDataAllowed != onlineDataAllowed) {
-        m_onlineDataAllowed = onlineDataAllowed;
+    if (fields & MlsdbLocationSettings::PositioningEnabled) {
+        qCDebug(lcGeoclueMlsdb) << "positioning is" << (settings.positioningEnabled ? "enabled" : "disabled");
     }
-    if (m_onlineDataAllowed) {
-        qCDebug(lcGeoclueMlsdb) << "allowed to use online data to determine position";
-    } else {
-        qCDebug(lcGeoclueMlsdb) << "not allowed to use online data to determine position";
+    if (fields & MlsdbLocationSettings::CellPositioningEnabled) {
+        qCDebug(lcGeoclueMlsdb) << "device-local cell triangulation positioning is" << (settings.cellPositioningEnabled ? "enabled" : "disabled");
+    }
+    if (fields & MlsdbLocationSettings::OnlinePositioningEnabled) {
+        qCDebug(lcGeoclueMlsdb) << "mls online service positioning is" << (settings.onlinePositioningEnabled ? "enabled" : "disabled");
+    }
+
+    if (fields & MlsdbLocationSettings::OnlineDataAllowed) {
+        if (settings.onlineDataAllowed) {
+            qCDebug(lcGeoclueMlsdb) << "allowed to use online data to determine position";
+        } else {
+            qCDebug(lcGeoclueMlsdb) << "not allowed to use online data to determine position";
+        }
     }
 
-    if (m_cellDataAllowed != cellDataAllowed) {
-        m_cellDataAllowed = cellDataAllowed;
-        if (!m_cellWatcher && m_cellDataAllowed) {
+    if (fields & MlsdbLocationSettings::CellDataAllowed) {
+        if (!m_cellWatcher && settings.cellDataAllowed) {
             qCDebug(lcGeoclueMlsdb) << "listening for cell data changes";
             m_cellWatcher = new QOfonoExtCellWatcher(this);
             connect(m_cellWatcher, &QOfonoExtCellWatcher::cellsChanged,
                     this, &MlsdbProvider::cellularNetworkRegistrationChanged);
-        } else if (m_cellWatcher && !m_cellDataAllowed) {
+        } else if (m_cellWatcher && !settings.cellDataAllowed) {
             qCDebug(lcGeoclueMlsdb) << "no longer listening for cell data changes";
             m_cellWatcher->deleteLater();
             m_cellWatcher = Q_NULLPTR;
         }
-    }
-    if (m_cellDataAllowed) {
-        qCDebug(lcGeoclueMlsdb) << "allowed to use adjacent cell id data to determine position";
-    } else {
-        qCDebug(lcGeoclueMlsdb) << "not allowed to use adjacent cell id data to determine position";
-    }
-
-    if (m_wlanDataAllowed != wlanDataAllowed) {
-        m_wlanDataAllowed = wlanDataAllowed;
-    }
-    if (m_wlanDataAllowed) {
-        qCDebug(lcGeoclueMlsdb) << "allowed to use wlan data to determine position";
-    } else {
-        qCDebug(lcGeoclueMlsdb) << "not allowed to use wlan data to determine position";
+        if (settings.cellDataAllowed) {
+            qCDebug(lcGeoclueMlsdb) << "allowed to use adjacent cell id data to determine position";
+        } else {
+            qCDebug(lcGeoclueMlsdb) << "not allowed to use adjacent cell id data to determine position";
+        }
     }
 
-    if (m_mlsdbOnlineLocator) {
-        m_mlsdbOnlineLocator->setWlanDataAllowed(m_wlanDataAllowed);
+    if (fields & MlsdbLocationSettings::WlanDataAllowed) {
+        if (settings.wlanDataAllowed) {
+            qCDebug(lcGeoclueMlsdb) << "allowed to use wlan data to determine position";
+        } else {
+            qCDebug(lcGeoclueMlsdb) << "not allowed to use wlan data to determine position";
+        }
+        if (m_mlsdbOnlineLocator) {
+            m_mlsdbOnlineLocator->setWlanDataAllowed(settings.wlanDataAllowed);
+        }
     }
 
     bool previous = m_positioningEnabled;
-    bool enabled = positioningEnabled && cellPositioningEnabled;
+    bool enabled = settings.positioningEnabled && settings.cellPositioningEnabled;
     if (previous == enabled) {
         return;
     }
@@ -641,23 +756,78 @@ void MlsdbProvider::updatePositioningEnabled()
 
 void MlsdbProvider::cellularNetworkRegistrationChanged()
 {
-    m_signalUpdateCell = true;
+    m_wakeups.count(MlsdbWakeupCounter::CellChange);
+    scheduleRecalculation();
+}
+
+/*
+    The position is recalculated when the cells or wlan access points seen
+    change, and otherwise only when a client has asked for an update interval,
+    see startRepeatTimer(). Changes tend to come in bursts (e.g. several
+    neighbour cells after a handover), which are handled together after
+    CoalesceInterval.
+*/
+void MlsdbProvider::scheduleRecalculation()
+{
+    if (!m_positioningStarted)
+        return;
+
+    if (!m_fixLostTimer.isActive())
+        startCoarseTimer(m_fixLostTimer, FixTimeout);
+    if (!m_recalculatePositionTimer.isActive()) {
+        if (m_screenOff)
+            startCoarseTimer(m_recalculatePositionTimer, ScreenOffCoalesceInterval);
+        else
+            m_recalculatePositionTimer.start(CoalesceInterval, Qt::CoarseTimer, this);
+    }
+}
+
+/*
+    Clients which have set an UpdateInterval get a position at that interval
+    even while nothing changes, so the position is recalculated (and the fix
+    lost if that fails) once the interval has passed since the last update.
+    Without it, positions are only emitted when something changes.
+*/
+void MlsdbProvider::startRepeatTimer()
+{
+    if (m_positioningStarted && updateIntervalRequested())
+        startCoarseTimer(m_repeatTimer, minimumRequestedUpdateInterval());
+    else
+        m_repeatTimer.stop();
+}
+
+// Emits the current location right away, unless that would be sooner than clients asked for.
+void MlsdbProvider::scheduleLocationEmission()
+{
+    if (m_emitTimer.isActive())
+        return; // the latest location is emitted when the timer fires.
+
+    const qint64 remaining = m_lastEmitted.isValid()
+                           ? minimumRequestedUpdateInterval() - m_lastEmitted.elapsed()
+                           : 0;
+    if (remaining <= 0) {
+        emitLocationChanged();
+    } else {
+        qCDebug(lcGeoclueMlsdbPosition) << "delaying position update for" << remaining << "ms";
+        startCoarseTimer(m_emitTimer, static_cast<int>(remaining));
+    }
 }
 
 void MlsdbProvider::emitLocationChanged()
 {
-    PositionFields positionFields = NoPositionFields;
+    m_lastEmitted.start();
+    startRepeatTimer();
 
-    if (!qIsNaN(m_currentLocation.latitude()))
-        positionFields |= LatitudePresent;
-    if (!qIsNaN(m_currentLocation.longitude()))
-        positionFields |= LongitudePresent;
-    if (!qIsNaN(m_currentLocation.altitude()))
-        positionFields |= AltitudePresent;
+    const Location location = m_publishedLocation.load();
+    emit PositionChanged(positionFields(location), location.timestamp() / 1000,
+                         location.latitude(), location.longitude(),
+                         location.altitude(), location.accuracy());
 
-    emit PositionChanged(positionFields, m_currentLocation.timestamp() / 1000,
-                         m_currentLocation.latitude(), m_currentLocation.longitude(),
-                         m_currentLocation.altitude(), m_currentLocation.accuracy());
+    if (m_currentLocationStale) {
+        mlsdbStartupTrace("position from snapshot emitted");
+    } else if (location.timestamp() != 0) {
+        mlsdbStartupTraceFinish("first position emitted");
+    }
 }
 
 void MlsdbProvider::startPositioningIfNeeded()
@@ -677,10 +847,16 @@ void MlsdbProvider::startPositioningIfNeeded()
     m_idleTimer.stop();
 
     qCDebug(lcGeoclueMlsdb) << "Starting positioning";
+    mlsdbStartupTrace("positioning started");
     m_positioningStarted = true;
+    startCoarseTimer(m_fixLostTimer, FixTimeout);
+    if (m_currentLocationStale) {
+        // better than nothing until the first position is calculated, the timestamp tells its age.
+        qCDebug(lcGeoclueMlsdb) << "handing out last position from before the restart";
+        setStatus(StatusAcquiring);
+        emitLocationChanged();
+    }
     calculatePositionAndEmitLocation();
-    quint32 updateInterval = minimumRequestedUpdateInterval();
-    m_recalculatePositionTimer.start(updateInterval, this);
 }
 
 void MlsdbProvider::stopPositioningIfNeeded()
@@ -698,6 +874,8 @@ void MlsdbProvider::stopPositioningIfNeeded()
     setStatus(StatusUnavailable);
     m_fixLostTimer.stop();
     m_recalculatePositionTimer.stop();
+    m_emitTimer.stop();
+    m_repeatTimer.stop();
 }
 
 void MlsdbProvider::setStatus(MlsdbProvider::Status status)
@@ -709,30 +887,6 @@ void MlsdbProvider::setStatus(MlsdbProvider::Status status)
     emit StatusChanged(m_status);
 }
 
-/*
-    Checks the state of the Location enabled setting,
-    the MLS enabled setting, and the MLS online_enabled setting.
-*/
-void MlsdbProvider::getEnabled(bool *positioningEnabled, bool *cellPositioningEnabled,
-                               bool *onlinePositioningEnabled, bool *onlineDataAllowed,
-                               bool *cellDataAllowed, bool *wlanDataAllowed)
-{
-    QSettings settings(LocationSettingsFile, QSettings::IniFormat);
-
-    *positioningEnabled = settings.value(LocationSettingsEnabledKey, false).toBool();
-
-    *cellPositioningEnabled = *positioningEnabled
-                            && (settings.value(LocationSettingsMlsEnabledKey, false).toBool()
-                             || settings.value(LocationSettingsOldMlsEnabledKey, false).toBool());
-
-    *onlinePositioningEnabled = *cellPositioningEnabled
-                            && settings.value(LocationSettingsMlsOnlineEnabledKey, false).toBool();
-
-    *onlineDataAllowed = settings.value(LocationSettingsDataSourceOnlineAllowedKey, true).toBool();
-    *cellDataAllowed = settings.value(LocationSettingsDataSourceCellDataAllowedKey, true).toBool();
-    *wlanDataAllowed = settings.value(LocationSettingsDataSourceWlanDataAllowedKey, true).toBool();
-}
-
 quint32 MlsdbProvider::minimumRequestedUpdateInterval() const
 {
     quint32 updateInterval = UINT_MAX;
@@ -752,7 +906,77 @@ quint32 MlsdbProvider::minimumRequestedUpdateInterval() const
     }
 
     if (updateInterval == UINT_MAX)
-        return MinimumInterval;
+        updateInterval = MinimumInterval;
 
-    return qMax(updateInterval, MinimumInterval);
+    return qMax(updateInterval, m_screenOff ? ScreenOffInterval : MinimumInterval);
+}
+
+bool MlsdbProvider::updateIntervalRequested() const
+{
+    foreach (const ServiceData &data, m_watchedServices) {
+        if (data.referenceCount > 0 && data.updateInterval != 0)
+            return true;
+    }
+    return false;
+}
+
+MlsdbProvider::PositionFields MlsdbProvider::positionFields(const Location &location)
+{
+    PositionFields fields = NoPositionFields;
+
+    if (!qIsNaN(location.latitude()))
+        fields |= LatitudePresent;
+    if (!qIsNaN(location.longitude()))
+        fields |= LongitudePresent;
+    if (!qIsNaN(location.altitude()))
+        fields |= AltitudePresent;
+
+    return fields;
+}
+
+// The strictest accuracy required by the clients, 0 if any of them wants the best available.
+quint32 MlsdbProvider::requiredAccuracy() const
+{
+    quint32 accuracy = UINT_MAX;
+
+    foreach (const ServiceData &data, m_watchedServices) {
+        if (data.referenceCount <= 0)
+            continue;
+        if (data.requiredAccuracy == 0)
+            return 0;
+        accuracy = qMin(accuracy, data.requiredAccuracy);
+    }
+
+    return accuracy == UINT_MAX ? 0 : accuracy;
+}
+
+void MlsdbProvider::displayStatusChanged(const QString &status)
+{
+    const bool screenOff = status == QLatin1String("off");
+    if (screenOff == m_screenOff)
+        return;
+
+    qCDebug(lcGeoclueMlsdb) << "display is" << status << (screenOff ? ", waking up less often" : "");
+    m_screenOff = screenOff;
+
+    // A pending update is due at a different time now.
+    if (m_emitTimer.isActive()) {
+        m_emitTimer.stop();
+        scheduleLocationEmission();
+    }
+    if (m_repeatTimer.isActive())
+        startRepeatTimer();
+}
+
+void MlsdbProvider::displayStatusReceived(QDBusPendingCallWatcher *call)
+{
+    QDBusPendingReply<QString> reply = *call;
+    if (reply.isError()) {
+        // only asked once, on startup.
+        qCWarning(lcGeoclueMlsdb) << "unable to get display status, wakeups are not reduced while the display is off:"
+                                  << reply.error().message();
+    } else {
+        displayStatusChanged(reply.value());
+    }
+    call->deleteLater();
 }
@@ -13,7 +13,6 @@
 #ifndef MLSDBPROVIDER_H
 #define MLSDBPROVIDER_H
 
-#include <QtCore/QFileSystemWatcher>
 #include <QtCore/QObject>
 #include <QtCore/QStringList>
 #include <QtCore/QBasicTimer>
@@ -21,11 +20,19 @@
 #include <QtCore/QSet>
 #include <QtCore/QMap>
 #include <QtCore/QDateTime>
+#include <QtCore/QElapsedTimer>
+#include <QtCore/QThread>
+#include <QtCore/QVector>
 #include <QtCore/QVariantMap>
 #include <QtDBus/QDBusContext>
 
 #include "locationtypes.h"
+#include "mlsdbcells.h"
+#include "mlsdbidlepolicy.h"
+#include "mlsdbpositionfilter.h"
 #include "mlsdbserialisation.h"
+#include "mlsdbsettings.h"
+#include "mlsdbwakeups.h"
 
 /*
 // TODO: use RIL to perform RIL_REQUEST_GET_NEIGHBORING_CELL_IDS
@@ -46,8 +53,11 @@ BuildRequires: pkgconfig(android-headers)
 */
 
 QT_FORWARD_DECLARE_CLASS(QDBusServiceWatcher)
+QT_FORWARD_DECLARE_CLASS(QDBusPendingCallWatcher)
 class QOfonoExtCellWatcher;
 class MlsdbOnlineLocator;
+class MlsdbCellLocator;
+class MlsdbSnapshot;
 
 /*
  * The geoclue-mlsdb provider provides position information
@@ -63,10 +73,7 @@ class MlsdbProvider : public QObject, public QDBusContext
     Q_OBJECT
 
 public:
-    struct CellPositioningData {
-        quint64 uniqueCellId;
-        quint32 signalStrength;
-    };
+    typedef MlsdbCellPositioningData CellPositioningData;
 
     explicit MlsdbProvider(QObject *parent = 0);
     ~MlsdbProvider();
@@ -112,68 +119,98 @@ signals:
     void PositionChanged(int fields, int timestamp, double latitude, double longitude, double altitude, const Accuracy &accuracy);
 
 private Q_SLOTS:
+    void initialize();
     void setLocation(const Location &location);
     void serviceUnregistered(const QString &service);
-    void updatePositioningEnabled();
+    void updatePositioningEnabled(MlsdbLocationSettings::Fields fields);
     void cellularNetworkRegistrationChanged();
     void onlineLocationFound(double latitude, double longitude, double accuracy);
     void onlineLocationError(const QString &errorString);
     void onlineWlanChanged();
+    void onlineReplyTimedOut();
+    void cellLocationEstimated(quint64 fingerprint, const Location &location);
+    void displayStatusChanged(const QString &status);
+    void displayStatusReceived(QDBusPendingCallWatcher *call);
 
 protected:
     void timerEvent(QTimerEvent *event) Q_DECL_OVERRIDE; // QObject
 
 private:
     void emitLocationChanged();
+    void scheduleLocationEmission();
+    void scheduleRecalculation();
+    void startRepeatTimer();
     void startPositioningIfNeeded();
     void stopPositioningIfNeeded();
     void setStatus(Status status);
-    void getEnabled(bool *positioningEnabled, bool *cellPositioningEnabled,
-                    bool *onlinePositioningEnabled, bool *onlineDataAllowed,
-                    bool *cellDataAllowed, bool *wlanDataAllowed);
     quint32 minimumRequestedUpdateInterval() const;
+    bool updateIntervalRequested() const;
+    quint32 requiredAccuracy() const;
+    static PositionFields positionFields(const Location &location);
     void calculatePositionAndEmitLocation();
+    void queryOnlineLocation(const Location &offlineEstimate);
+    void writeSnapshot();
+    void startIdleTimer();
+    void startCoarseTimer(QBasicTimer &timer, int interval);
 
-    QList<CellPositioningData> seenCellIds() const;
-    void updateLocationFromCells(const QList<CellPositioningData> &cells);
-    bool searchForCellIdLocation(quint64 uniqueCellId, MlsdbCoords *coords);
+    const MlsdbSeenCells &seenCellIds();
+    void updateLocationFromCells(const MlsdbSeenCells &cells);
+    void updateLocationFromEstimate(const Location &deviceLocation);
+    static quint64 cellsFingerprint(const MlsdbSeenCells &cells);
 
-    QFileSystemWatcher m_locationSettingsWatcher;
+    MlsdbSettingsWatcher m_settings;
     bool m_positioningEnabled;
-    bool m_cellDataAllowed;
     bool m_positioningStarted;
+    bool m_initialized;
     Status m_status;
     Location m_currentLocation;
+    AtomicLocation m_publishedLocation; // m_currentLocation, for GetPosition() and PositionChanged
+    bool m_currentLocationStale; // from before a restart
     Location m_lastLocation;
+    MlsdbPositionFilter m_positionFilter; // fuses the estimates from the cells and from online
 
     MlsdbOnlineLocator *m_mlsdbOnlineLocator;
-    bool m_onlinePositioningEnabled;
-    bool m_onlineDataAllowed;
-    bool m_wlanDataAllowed;
     QPair<QDateTime, QVariantMap> m_previousQuery;
+    int m_skippedOnlineQueries; // as the offline estimate was accurate enough
 
     QOfonoExtCellWatcher *m_cellWatcher;
-    QMap<quint64, MlsdbCoords> m_uniqueCellIdToLocation; // cache
-    QSet<quint64> m_knownCellIdsWithUnknownLocations;
+    MlsdbSeenCells m_seenCells; // filled by seenCellIds()
+    MlsdbSnapshot *m_snapshot;
+    quint64 m_dataStamp; // of the data files when started
+    QThread m_cellLocatorThread;
+    MlsdbCellLocator *m_cellLocator; // lives in m_cellLocatorThread
+    quint64 m_cellsFingerprint; // of the cells m_cellsEstimate was calculated from
+    Location m_cellsEstimate;
+    quint64 m_requestedFingerprint;
+    bool m_estimatePending;
+    QElapsedTimer m_estimateClock;
+    QBasicTimer m_latencyProbeTimer; // samples main loop stalls while m_cellLocator works, when lcGeoclueMlsdbLatency is enabled.
+    QElapsedTimer m_latencyProbeClock;
+    qint64 m_longestStall;
 
     QDBusServiceWatcher *m_watcher;
     struct ServiceData {
         ServiceData()
-        :   referenceCount(0), updateInterval(0)
+        :   referenceCount(0), updateInterval(0), requiredAccuracy(0)
         {
         }
 
         int referenceCount;
         quint32 updateInterval;
+        quint32 requiredAccuracy; // metres, 0 if not set
     };
     QMap<QString, ServiceData> m_watchedServices;
 
-    QBasicTimer m_idleTimer;    // qApp->quit() if positioning is off for long enough.
-    QBasicTimer m_fixLostTimer; // after fix timeout, status set to Acquiring.  timer is reset when a position is calculated.
-    QBasicTimer m_recalculatePositionTimer;
-
-    bool m_signalUpdateCell;
-    bool m_signalUpdateWlan;
+    MlsdbIdlePolicy m_idlePolicy;
+    QBasicTimer m_idleTimer;    // qApp->quit() if positioning is off for long enough, see m_idlePolicy.
+    QBasicTimer m_fixLostTimer; // after fix timeout, status set to Acquiring.  timer is stopped when a position is calculated.
+    QBasicTimer m_recalculatePositionTimer; // coalesces bursts of cell and wlan changes into one recalculation.
+    QBasicTimer m_emitTimer;    // delays PositionChanged until the update interval requested by clients has passed.
+    QBasicTimer m_repeatTimer;  // recalculates after the update interval requested by clients, even if nothing changed.
+    QElapsedTimer m_lastEmitted;
+    int m_timerSlack;           // msecs, timers expire on multiples of this, so that they expire together.
+    bool m_screenOff;           // fewer and coarser wakeups while nobody is looking.
+    MlsdbWakeupCounter m_wakeups;
 };
 
 Q_DECLARE_OPERATORS_FOR_FLAGS(MlsdbProvider::PositionFields)
@@ -0,0 +1,130 @@
+/*
+    Copyright (C) 2022 Jolla Ltd.
+    Contact: Daniel Suni <daniel.suni@jolla.com>
+
+    This file is part of geoclue-mlsdb.
+
+    Geoclue-mlsdb is free software; you can redistribute it and/or
+    modify it under the terms of the GNU Lesser General Public
+    License as published by the Free Software Foundation; either
+    version 2.1 of the License.
+*/
+
+#include "mlsdbsettings.h"
+#include "mlsdblogging.h"
+
+#include <QtCore/QFile>
+#include <QtCore/QSettings>
+
+#include <sys/stat.h>
+
+namespace {
+    const QString LocationSettingsDir = QStringLiteral("/var/lib/location/");
+    const QString LocationSettingsFile = QStringLiteral("/var/lib/location/location.conf");
+    const QString LocationSettingsEnabledKey = QStringLiteral("location/enabled");
+    const QString LocationSettingsMlsEnabledKey = QStringLiteral("location/mls/enabled");
+    const QString LocationSettingsMlsOnlineEnabledKey = QStringLiteral("location/mls/online_enabled");
+    const QString LocationSettingsOldMlsEnabledKey = QStringLiteral("location/cell_id_positioning_enabled"); // deprecated key
+    const QString LocationSettingsDataSourceOnlineAllowedKey = QStringLiteral("location/allowed_data_sources/online");
+    const QString LocationSettingsDataSourceCellDataAllowedKey = QStringLiteral("location/allowed_data_sources/cell_data");
+    const QString LocationSettingsDataSourceWlanDataAllowedKey = QStringLiteral("location/allowed_data_sources/wlan_data");
+}
+
+MlsdbLocationSettings::Fields MlsdbLocationSettings::changedFields(const MlsdbLocationSettings &other) const
+{
+    Fields fields = NoFields;
+    if (positioningEnabled != other.positioningEnabled)
+        fields |= PositioningEnabled;
+    if (cellPositioningEnabled != other.cellPositioningEnabled)
+        fields |= CellPositioningEnabled;
+    if (onlinePositioningEnabled != other.onlinePositioningEnabled)
+        fields |= OnlinePositioningEnabled;
+    if (onlineDataAllowed != other.onlineDataAllowed)
+        fields |= OnlineDataAllowed;
+    if (cellDataAllowed != other.cellDataAllowed)
+        fields |= CellDataAllowed;
+    if (wlanDataAllowed != other.wlanDataAllowed)
+        fields |= WlanDataAllowed;
+    return fields;
+}
+
+MlsdbSettingsWatcher::MlsdbSettingsWatcher(QObject *parent)
+:   QObject(parent),
+    m_device(0),
+    m_inode(0),
+    m_size(-1),
+    m_modified(-1)
+{
+    connect(&m_watcher, &QFileSystemWatcher::fileChanged,
+            this, &MlsdbSettingsWatcher::pathChanged);
+    connect(&m_watcher, &QFileSystemWatcher::directoryChanged,
+            this, &MlsdbSettingsWatcher::pathChanged);
+}
+
+void MlsdbSettingsWatcher::start()
+{
+    m_watcher.addPath(LocationSettingsDir);
+    m_watcher.addPath(LocationSettingsFile);
+    fileChanged();
+    m_settings = read();
+}
+
+void MlsdbSettingsWatcher::pathChanged()
+{
+    // The file is replaced rather than written in place, which drops it from the watcher.
+    if (!m_watcher.files().contains(LocationSettingsFile) && QFile::exists(LocationSettingsFile))
+        m_watcher.addPath(LocationSettingsFile);
+
+    if (!fileChanged())
+        return;
+
+    const MlsdbLocationSettings settings = read();
+    const MlsdbLocationSettings::Fields fields = settings.changedFields(m_settings);
+    m_settings = settings;
+    if (fields != MlsdbLocationSettings::NoFields)
+        emit changed(fields);
+}
+
+// Updates the stored identity of the file, and tells whether it differs from before.
+bool MlsdbSettingsWatcher::fileChanged()
+{
+    struct stat st;
+    if (stat(LocationSettingsFile.toLocal8Bit().constData(), &st) != 0) {
+        st.st_dev = 0;
+        st.st_ino = 0;
+        st.st_size = -1;
+        st.st_mtim.tv_sec = -1;
+        st.st_mtim.tv_nsec = 0;
+    }
+    const qint64 modified = qint64(st.st_mtim.tv_sec) * 1000000000 + st.st_mtim.tv_nsec;
+    if (st.st_dev == m_device && st.st_ino == m_inode && st.st_size == m_size && modified == m_modified)
+        return false;
+
+    m_device = st.st_dev;
+    m_inode = st.st_ino;
+    m_size = st.st_size;
+    m_modified = modified;
+    return true;
+}
+
+MlsdbLocationSettings MlsdbSettingsWatcher::read() const
+{
+    QSettings file(LocationSettingsFile, QSettings::IniFormat);
+    MlsdbLocationSettings settings;
+
+    settings.positioningEnabled = file.value(LocationSettingsEnabledKey, false).toBool();
+
+    settings.cellPositioningEnabled = settings.positioningEnabled
+                                   && (file.value(LocationSettingsMlsEnabledKey, false).toBool()
+                                    || file.value(LocationSettingsOldMlsEnabledKey, false).toBool());
+
+    settings.onlinePositioningEnabled = settings.cellPositioningEnabled
+                                     && file.value(LocationSettingsMlsOnlineEnabledKey, false).toBool();
+
+    settings.onlineDataAllowed = file.value(LocationSettingsDataSourceOnlineAllowedKey, true).toBool();
+    settings.cellDataAllowed = file.value(LocationSettingsDataSourceCellDataAllowedKey, true).toBool();
+    settings.wlanDataAllowed = file.value(LocationSettingsDataSourceWlanDataAllowedKey, true).toBool();
+
+    qCDebug(lcGeoclueMlsdb) << "read location settings";
+    return settings;
+}
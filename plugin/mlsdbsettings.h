@@ -0,0 +1,96 @@
+/*
+    Copyright (C) 2022 Jolla Ltd.
+    Contact: Daniel Suni <daniel.suni@jolla.com>
+
+    This file is part of geoclue-mlsdb.
+
+    Geoclue-mlsdb is free software; you can redistribute it and/or
+    modify it under the terms of the GNU Lesser General Public
+    License as published by the Free Software Foundation; either
+    version 2.1 of the License.
+*/
+
+#ifndef MLSDBSETTINGS_H
+#define MLSDBSETTINGS_H
+
+#include <QtCore/QFileSystemWatcher>
+#include <QtCore/QObject>
+
+#include <sys/types.h>
+
+/*
+ * The location settings which matter to the provider, as read from
+ * /var/lib/location/location.conf.
+ */
+
+struct MlsdbLocationSettings
+{
+    enum Field {
+        NoFields = 0x00,
+        PositioningEnabled = 0x01,
+        CellPositioningEnabled = 0x02,
+        OnlinePositioningEnabled = 0x04,
+        OnlineDataAllowed = 0x08,
+        CellDataAllowed = 0x10,
+        WlanDataAllowed = 0x20,
+        AllFields = 0x3F
+    };
+    Q_DECLARE_FLAGS(Fields, Field)
+
+    MlsdbLocationSettings()
+        : positioningEnabled(false), cellPositioningEnabled(false), onlinePositioningEnabled(false),
+          onlineDataAllowed(true), cellDataAllowed(true), wlanDataAllowed(true)
+    { }
+
+    Fields changedFields(const MlsdbLocationSettings &other) const;
+
+    bool positioningEnabled;
+    bool cellPositioningEnabled;   // implies positioningEnabled
+    bool onlinePositioningEnabled; // implies cellPositioningEnabled
+    bool onlineDataAllowed;
+    bool cellDataAllowed;
+    bool wlanDataAllowed;
+};
+
+Q_DECLARE_OPERATORS_FOR_FLAGS(MlsdbLocationSettings::Fields)
+
+/*
+ * Watches the settings file, and re-reads it only when it has been
+ * replaced or modified, rather than on every change in its directory.
+ * The settings are replaced as a whole, and changed() tells which of
+ * them are different from before.
+ */
+
+class MlsdbSettingsWatcher : public QObject
+{
+    Q_OBJECT
+
+public:
+    explicit MlsdbSettingsWatcher(QObject *parent = 0);
+
+    // Reads the settings and starts watching for changes.
+    void start();
+
+    const MlsdbLocationSettings &settings() const { return m_settings; }
+
+signals:
+    void changed(MlsdbLocationSettings::Fields fields);
+
+private Q_SLOTS:
+    void pathChanged();
+
+private:
+    bool fileChanged();
+    MlsdbLocationSettings read() const;
+
+    QFileSystemWatcher m_watcher;
+    MlsdbLocationSettings m_settings;
+
+    // Identity and modification time of the file when it was last read.
+    dev_t m_device;
+    ino_t m_inode;
+    off_t m_size;
+    qint64 m_modified; // nanoseconds
+};
+
+#endif // MLSDBSETTINGS_H
@@ -0,0 +1,291 @@
+/*
+    Copyright (C) 2022 Jolla Ltd.
+    Contact: Daniel Suni <daniel.suni@jolla.com>
+
+    This file is part of geoclue-mlsdb.
+
+    Geoclue-mlsdb is free software; you can redistribute it and/or
+    modify it under the terms of the GNU Lesser General Public
+    License as published by the Free Software Foundation; either
+    version 2.1 of the License.
+*/
+
+#include "mlsdbsnapshot.h"
+#include "mlsdblogging.h"
+
+#include <QtCore/QDateTime>
+#include <QtCore/QDir>
+#include <QtCore/QFileInfo>
+#include <QtCore/QSaveFile>
+#include <QtCore/QStandardPaths>
+
+#include <algorithm>
+#include <string.h>
+
+namespace {
+    const quint32 SnapshotMagic = 0x534c4d47;   // "GMLS" in little endian
+    const quint32 SnapshotVersion = 2;          // bump whenever the layout below changes
+    const int MaxQueryTimestamps = 16;
+    const int MaxActivationTimes = 16;
+    const int MaxCells = 4096;                  // 96 kB
+    const int MaxUnknownCells = 1024;           // 8 kB
+
+    // FNV-1a, which is small and stable between releases, unlike qHash().
+    quint64 hashBytes(quint64 hash, const void *data, size_t length)
+    {
+        const uchar *bytes = static_cast<const uchar *>(data);
+        for (size_t i = 0; i < length; ++i) {
+            hash = (hash ^ bytes[i]) * Q_UINT64_C(0x100000001B3);
+        }
+        return hash;
+    }
+}
+
+// The snapshot is a cache private to the device, so it is in native byte order.
+struct MlsdbSnapshot::Header {
+    quint32 magic;
+    quint32 version;
+    quint64 dataStamp;
+
+    qint64 timestamp;
+    double latitude;
+    double longitude;
+    double altitude;
+    double horizontalAccuracy;
+    double verticalAccuracy;
+
+    qint64 lastQueryTime;
+    quint32 adaptiveInterval;
+    quint32 backOffFactor;
+    quint32 queryTimestampCount;
+    quint32 cellCount;
+    quint32 unknownCellCount;
+    quint32 reserved;
+    qint64 queryTimestamps[MaxQueryTimestamps];
+    quint32 activationTimeCount;
+    quint32 reserved2;
+    qint64 activationTimes[MaxActivationTimes];
+};
+
+// Sorted by uniqueCellId, followed by the sorted ids of unknown cells.
+struct MlsdbSnapshot::Cell {
+    quint64 uniqueCellId;
+    float latitude;
+    float longitude;
+    float range;
+    float samples;
+};
+
+MlsdbSnapshot::MlsdbSnapshot()
+:   m_header(0),
+    m_cells(0),
+    m_unknownCells(0),
+    m_cellCount(0),
+    m_unknownCellCount(0)
+{
+}
+
+MlsdbSnapshot::~MlsdbSnapshot()
+{
+}
+
+bool MlsdbSnapshot::map(const QString &path, quint64 dataStamp)
+{
+    m_file.setFileName(path);
+    if (!m_file.open(QIODevice::ReadOnly)) {
+        qCDebug(lcGeoclueMlsdb) << "no snapshot to start from";
+        return false;
+    }
+
+    const qint64 size = m_file.size();
+    const uchar *data = size >= (qint64)sizeof(Header) ? m_file.map(0, size) : 0;
+    const Header *header = reinterpret_cast<const Header *>(data);
+    if (!header || header->magic != SnapshotMagic || header->version != SnapshotVersion
+            || header->queryTimestampCount > MaxQueryTimestamps
+            || header->activationTimeCount > MaxActivationTimes
+            || size != (qint64)(sizeof(Header) + header->cellCount * sizeof(Cell)
+                                + header->unknownCellCount * sizeof(quint64))) {
+        qCWarning(lcGeoclueMlsdb) << "ignoring invalid snapshot" << path;
+        m_file.close();
+        return false;
+    }
+
+    m_header = header;
+    if (header->dataStamp == dataStamp) {
+        m_cells = reinterpret_cast<const Cell *>(data + sizeof(Header));
+        m_unknownCells = reinterpret_cast<const quint64 *>(m_cells + header->cellCount);
+        m_cellCount = header->cellCount;
+        m_unknownCellCount = header->unknownCellCount;
+    } else {
+        qCDebug(lcGeoclueMlsdb) << "data files have changed, not using cells from the snapshot";
+    }
+    qCDebug(lcGeoclueMlsdb) << "started from snapshot with" << m_cellCount << "cells";
+    return true;
+}
+
+Location MlsdbSnapshot::lastLocation() const
+{
+    Location location;
+    if (m_header && m_header->timestamp != 0) {
+        location.setTimestamp(m_header->timestamp);
+        location.setLatitude(m_header->latitude);
+        location.setLongitude(m_header->longitude);
+        location.setAltitude(m_header->altitude);
+        Accuracy accuracy;
+        accuracy.setHorizontal(m_header->horizontalAccuracy);
+        accuracy.setVertical(m_header->verticalAccuracy);
+        location.setAccuracy(accuracy);
+    }
+    return location;
+}
+
+MlsdbSnapshot::OnlineState MlsdbSnapshot::onlineState() const
+{
+    OnlineState state;
+    if (m_header) {
+        state.lastQueryTime = m_header->lastQueryTime;
+        state.adaptiveInterval = m_header->adaptiveInterval;
+        state.backOffFactor = m_header->backOffFactor;
+        for (quint32 i = 0; i < m_header->queryTimestampCount; ++i) {
+            state.queryTimestamps.append(m_header->queryTimestamps[i]);
+        }
+    }
+    return state;
+}
+
+QVector<qint64> MlsdbSnapshot::activationTimes() const
+{
+    QVector<qint64> activationTimes;
+    if (m_header) {
+        activationTimes.reserve(m_header->activationTimeCount);
+        for (quint32 i = 0; i < m_header->activationTimeCount; ++i) {
+            activationTimes.append(m_header->activationTimes[i]);
+        }
+    }
+    return activationTimes;
+}
+
+bool MlsdbSnapshot::findCell(quint64 uniqueCellId, MlsdbCellLocator::CellLocation *location) const
+{
+    const Cell *end = m_cells + m_cellCount;
+    const Cell *cell = std::lower_bound(m_cells, end, uniqueCellId,
+                                        [](const Cell &c, quint64 id) { return c.uniqueCellId < id; });
+    if (cell == end || cell->uniqueCellId != uniqueCellId) {
+        return false;
+    }
+    location->coords.lat = cell->latitude;
+    location->coords.lon = cell->longitude;
+    location->range = cell->range;
+    location->samples = cell->samples;
+    return true;
+}
+
+bool MlsdbSnapshot::isUnknownCell(quint64 uniqueCellId) const
+{
+    return std::binary_search(m_unknownCells, m_unknownCells + m_unknownCellCount, uniqueCellId);
+}
+
+bool MlsdbSnapshot::write(const QString &path, quint64 dataStamp,
+                          const Location &lastLocation, const OnlineState &onlineState,
+                          const QVector<qint64> &activationTimes,
+                          const QVector<MlsdbCellLocator::CachedCell> &cells,
+                          const MlsdbSnapshot *previous)
+{
+    // The cells used most recently since the start come first, then the ones from
+    // before, lowest ids first as their use isn't recorded, as far as they fit.
+    // They are written sorted by id all the same.
+    QVector<MlsdbCellLocator::CachedCell> recentCells(cells);
+    std::stable_sort(recentCells.begin(), recentCells.end(),
+                     [](const MlsdbCellLocator::CachedCell &a, const MlsdbCellLocator::CachedCell &b) {
+                         return a.lastUsed > b.lastUsed;
+                     });
+    QMap<quint64, Cell> allCells;
+    QSet<quint64> allUnknownCells;
+    for (const MlsdbCellLocator::CachedCell &cached : recentCells) {
+        if (cached.known && allCells.size() < MaxCells) {
+            const MlsdbCellLocator::CellLocation &location(cached.location);
+            Cell cell = { cached.uniqueCellId, location.coords.lat, location.coords.lon,
+                          float(location.range), float(location.samples) };
+            allCells.insert(cached.uniqueCellId, cell);
+        } else if (!cached.known && allUnknownCells.size() < MaxUnknownCells) {
+            allUnknownCells.insert(cached.uniqueCellId);
+        }
+    }
+    if (previous) {
+        for (quint32 i = 0; i < previous->m_cellCount && allCells.size() < MaxCells; ++i) {
+            if (!allCells.contains(previous->m_cells[i].uniqueCellId))
+                allCells.insert(previous->m_cells[i].uniqueCellId, previous->m_cells[i]);
+        }
+        for (quint32 i = 0; i < previous->m_unknownCellCount && allUnknownCells.size() < MaxUnknownCells; ++i) {
+            allUnknownCells.insert(previous->m_unknownCells[i]);
+        }
+    }
+    QVector<quint64> sortedUnknownCells = allUnknownCells.toList().toVector();
+    std::sort(sortedUnknownCells.begin(), sortedUnknownCells.end());
+
+    Header header;
+    memset(&header, 0, sizeof(header));
+    header.magic = SnapshotMagic;
+    header.version = SnapshotVersion;
+    header.dataStamp = dataStamp;
+    header.timestamp = lastLocation.timestamp();
+    header.latitude = lastLocation.latitude();
+    header.longitude = lastLocation.longitude();
+    header.altitude = lastLocation.altitude();
+    header.horizontalAccuracy = lastLocation.accuracy().horizontal();
+    header.verticalAccuracy = lastLocation.accuracy().vertical();
+    header.lastQueryTime = onlineState.lastQueryTime;
+    header.adaptiveInterval = onlineState.adaptiveInterval;
+    header.backOffFactor = onlineState.backOffFactor;
+    header.queryTimestampCount = qMin(onlineState.queryTimestamps.size(), MaxQueryTimestamps);
+    for (quint32 i = 0; i < header.queryTimestampCount; ++i) {
+        header.queryTimestamps[i] = onlineState.queryTimestamps.at(i);
+    }
+    // the most recent ones.
+    header.activationTimeCount = qMin(activationTimes.size(), MaxActivationTimes);
+    for (quint32 i = 0; i < header.activationTimeCount; ++i) {
+        header.activationTimes[i] = activationTimes.at(activationTimes.size() - header.activationTimeCount + i);
+    }
+    header.cellCount = allCells.size();
+    header.unknownCellCount = sortedUnknownCells.size();
+
+    QDir().mkpath(QFileInfo(path).absolutePath());
+    QSaveFile file(path);
+    if (!file.open(QIODevice::WriteOnly)) {
+        qCWarning(lcGeoclueMlsdb) << "unable to write snapshot" << path << file.errorString();
+        return false;
+    }
+    file.write(reinterpret_cast<const char *>(&header), sizeof(header));
+    Q_FOREACH (const Cell &cell, allCells) {
+        file.write(reinterpret_cast<const char *>(&cell), sizeof(cell));
+    }
+    file.write(reinterpret_cast<const char *>(sortedUnknownCells.constData()),
+               sortedUnknownCells.size() * sizeof(quint64));
+    if (!file.commit()) {
+        qCWarning(lcGeoclueMlsdb) << "unable to write snapshot" << path << file.errorString();
+        return false;
+    }
+    qCDebug(lcGeoclueMlsdb) << "wrote snapshot with" << header.cellCount << "cells";
+    return true;
+}
+
+quint64 MlsdbSnapshot::dataStamp(const QString &dataDirectory)
+{
+    quint64 stamp = Q_UINT64_C(0xCBF29CE484222325);
+    const QFileInfoList files = QDir(dataDirectory).entryInfoList(QDir::Files, QDir::Name);
+    Q_FOREACH (const QFileInfo &info, files) {
+        const QByteArray name = info.fileName().toUtf8();
+        const qint64 size = info.size();
+        const qint64 modified = info.lastModified().toMSecsSinceEpoch();
+        stamp = hashBytes(stamp, name.constData(), name.size());
+        stamp = hashBytes(stamp, &size, sizeof(size));
+        stamp = hashBytes(stamp, &modified, sizeof(modified));
+    }
+    return stamp;
+}
+
+QString MlsdbSnapshot::defaultPath()
+{
+    return QStandardPaths::writableLocation(QStandardPaths::GenericCacheLocation)
+            + QStringLiteral("/geoclue-mlsdb/snapshot");
+}
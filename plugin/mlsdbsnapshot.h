@@ -0,0 +1,86 @@
+/*
+    Copyright (C) 2022 Jolla Ltd.
+    Contact: Daniel Suni <daniel.suni@jolla.com>
+
+    This file is part of geoclue-mlsdb.
+
+    Geoclue-mlsdb is free software; you can redistribute it and/or
+    modify it under the terms of the GNU Lesser General Public
+    License as published by the Free Software Foundation; either
+    version 2.1 of the License.
+*/
+
+#ifndef MLSDBSNAPSHOT_H
+#define MLSDBSNAPSHOT_H
+
+#include <QtCore/QFile>
+#include <QtCore/QMap>
+#include <QtCore/QSet>
+#include <QtCore/QVector>
+
+#include "locationtypes.h"
+#include "mlsdbcelllocator.h"
+
+/*
+ * The provider quits when it has been idle for a while, and is started
+ * again by D-Bus activation. To avoid starting from scratch each time, it
+ * writes a snapshot of its state when it quits:
+ *  - the last position, which is handed out (with its original timestamp)
+ *    until a new one is calculated,
+ *  - the cells looked up from the data files, and the cells which are not
+ *    in them,
+ *  - the back-off state of the online locator,
+ *  - when clients activated positioning, see MlsdbIdlePolicy.
+ *
+ * The snapshot is memory mapped on startup, and cells are looked up from
+ * it directly. The cells are only used if the data files haven't changed
+ * since the snapshot was written.
+ */
+
+class MlsdbSnapshot
+{
+public:
+    struct OnlineState {
+        OnlineState() : lastQueryTime(0), adaptiveInterval(0), backOffFactor(0) { }
+
+        qint64 lastQueryTime; // msecs since epoch, 0 if none
+        quint32 adaptiveInterval;
+        quint32 backOffFactor;
+        QVector<qint64> queryTimestamps;
+    };
+
+    MlsdbSnapshot();
+    ~MlsdbSnapshot();
+
+    bool map(const QString &path, quint64 dataStamp);
+
+    Location lastLocation() const;
+    OnlineState onlineState() const;
+    QVector<qint64> activationTimes() const;
+    bool findCell(quint64 uniqueCellId, MlsdbCellLocator::CellLocation *location) const;
+    bool isUnknownCell(quint64 uniqueCellId) const;
+
+    // Known and unknown cells from previous, if any, are kept as far as there is room.
+    static bool write(const QString &path, quint64 dataStamp,
+                      const Location &lastLocation, const OnlineState &onlineState,
+                      const QVector<qint64> &activationTimes,
+                      const QVector<MlsdbCellLocator::CachedCell> &cells,
+                      const MlsdbSnapshot *previous);
+
+    // Changes whenever any of the data files is replaced.
+    static quint64 dataStamp(const QString &dataDirectory);
+    static QString defaultPath();
+
+private:
+    struct Header;
+    struct Cell;
+
+    QFile m_file;
+    const Header *m_header;
+    const Cell *m_cells;
+    const quint64 *m_unknownCells;
+    quint32 m_cellCount;
+    quint32 m_unknownCellCount;
+};
+
+#endif // MLSDBSNAPSHOT_H
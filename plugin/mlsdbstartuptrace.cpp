@@ -0,0 +1,49 @@
+/*
+    Copyright (C) 2022 Jolla Ltd.
+    Contact: Daniel Suni <daniel.suni@jolla.com>
+
+    This file is part of geoclue-mlsdb.
+
+    Geoclue-mlsdb is free software; you can redistribute it and/or
+    modify it under the terms of the GNU Lesser General Public
+    License as published by the Free Software Foundation; either
+    version 2.1 of the License.
+*/
+
+#include "mlsdbstartuptrace.h"
+
+#include <QtCore/QElapsedTimer>
+#include <QtGlobal>
+
+#include <stdio.h>
+
+namespace {
+    enum TraceState {
+        TraceNotStarted,
+        TraceRunning,
+        TraceOff
+    };
+    TraceState traceState = TraceNotStarted;
+    QElapsedTimer traceClock;
+    qint64 previousPhase = 0;
+}
+
+void mlsdbStartupTrace(const char *phase)
+{
+    if (traceState == TraceNotStarted) {
+        traceState = qEnvironmentVariableIsSet("GEOCLUE_MLSDB_STARTUP_TRACE") ? TraceRunning : TraceOff;
+        traceClock.start();
+    }
+    if (traceState != TraceRunning)
+        return;
+
+    const qint64 now = traceClock.nsecsElapsed();
+    fprintf(stderr, "startup: %9.1f ms  (+%8.1f ms)  %s\n", now / 1e6, (now - previousPhase) / 1e6, phase);
+    previousPhase = now;
+}
+
+void mlsdbStartupTraceFinish(const char *phase)
+{
+    mlsdbStartupTrace(phase);
+    traceState = TraceOff;
+}
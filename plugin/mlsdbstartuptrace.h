@@ -0,0 +1,27 @@
+/*
+    Copyright (C) 2022 Jolla Ltd.
+    Contact: Daniel Suni <daniel.suni@jolla.com>
+
+    This file is part of geoclue-mlsdb.
+
+    Geoclue-mlsdb is free software; you can redistribute it and/or
+    modify it under the terms of the GNU Lesser General Public
+    License as published by the Free Software Foundation; either
+    version 2.1 of the License.
+*/
+
+#ifndef MLSDBSTARTUPTRACE_H
+#define MLSDBSTARTUPTRACE_H
+
+/*
+ * When GEOCLUE_MLSDB_STARTUP_TRACE is set in the environment, the time
+ * of each startup phase is printed to stderr, measured from main() until
+ * the first position is emitted:
+ *   startup:    12.3 ms  (+    4.1 ms)  registered on the bus
+ * Calls are cheap no-ops otherwise, and after the trace has finished.
+ */
+
+void mlsdbStartupTrace(const char *phase);
+void mlsdbStartupTraceFinish(const char *phase);
+
+#endif // MLSDBSTARTUPTRACE_H
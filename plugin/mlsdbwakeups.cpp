@@ -0,0 +1,56 @@
+/*
+    Copyright (C) 2022 Jolla Ltd.
+    Contact: Daniel Suni <daniel.suni@jolla.com>
+
+    This file is part of geoclue-mlsdb.
+
+    Geoclue-mlsdb is free software; you can redistribute it and/or
+    modify it under the terms of the GNU Lesser General Public
+    License as published by the Free Software Foundation; either
+    version 2.1 of the License.
+*/
+
+#include "mlsdbwakeups.h"
+#include "mlsdblogging.h"
+
+#include <string.h>
+
+namespace {
+    const qint64 ReportInterval = 3600000; // 1h
+}
+
+MlsdbWakeupCounter::MlsdbWakeupCounter()
+{
+    memset(m_counts, 0, sizeof(m_counts));
+    m_clock.start();
+}
+
+void MlsdbWakeupCounter::count(Source source)
+{
+    ++m_counts[source];
+    if (m_clock.elapsed() >= ReportInterval) {
+        report();
+    }
+}
+
+void MlsdbWakeupCounter::report()
+{
+    const qint64 elapsed = m_clock.restart();
+    if (elapsed > 0 && lcGeoclueMlsdbWakeups().isDebugEnabled()) {
+        // scaled to an hour, the provider may not have run for that long.
+        const double scale = double(ReportInterval) / elapsed;
+        const int timers = m_counts[IdleTimer] + m_counts[FixLostTimer]
+                         + m_counts[RecalculationTimer] + m_counts[EmissionTimer]
+                         + m_counts[RepeatTimer] + m_counts[LatencyProbeTimer]
+                         + m_counts[OnlineReplyTimer];
+        const int events = m_counts[CellChange] + m_counts[WlanChange] + m_counts[DBusCall];
+        qCDebug(lcGeoclueMlsdbWakeups).nospace()
+                << "wakeups per hour: " << qRound((timers + events) * scale)
+                << " timers: " << qRound(timers * scale)
+                << " cells: " << qRound(m_counts[CellChange] * scale)
+                << " wlan: " << qRound(m_counts[WlanChange] * scale)
+                << " dbus: " << qRound(m_counts[DBusCall] * scale)
+                << " (over " << elapsed / 1000 << " s)";
+    }
+    memset(m_counts, 0, sizeof(m_counts));
+}
@@ -0,0 +1,56 @@
+/*
+    Copyright (C) 2022 Jolla Ltd.
+    Contact: Daniel Suni <daniel.suni@jolla.com>
+
+    This file is part of geoclue-mlsdb.
+
+    Geoclue-mlsdb is free software; you can redistribute it and/or
+    modify it under the terms of the GNU Lesser General Public
+    License as published by the Free Software Foundation; either
+    version 2.1 of the License.
+*/
+
+#ifndef MLSDBWAKEUPS_H
+#define MLSDBWAKEUPS_H
+
+#include <QtCore/QElapsedTimer>
+
+/*
+ * Counts how often the provider is woken up, by its own timers and by
+ * outside events, to compare the power use of releases. Every timer the
+ * provider arms is counted, including the online reply timeout and the
+ * latency probe, which only runs while its logging category is enabled. The counts are
+ * logged as wakeups per hour to the geoclue.provider.mlsdb.wakeups
+ * category, whenever an hour has passed and when the provider quits:
+ *   wakeups per hour: 42 timers: 30 cells: 10 wlan: 0 dbus: 2
+ * The counting doesn't add any wakeups of its own.
+ */
+
+class MlsdbWakeupCounter
+{
+public:
+    enum Source {
+        IdleTimer,
+        FixLostTimer,
+        RecalculationTimer,
+        EmissionTimer,
+        RepeatTimer,
+        LatencyProbeTimer,
+        OnlineReplyTimer,
+        CellChange,
+        WlanChange,
+        DBusCall,
+        SourceCount
+    };
+
+    MlsdbWakeupCounter();
+
+    void count(Source source);
+    void report();
+
+private:
+    QElapsedTimer m_clock;
+    int m_counts[SourceCount];
+};
+
+#endif // MLSDBWAKEUPS_H
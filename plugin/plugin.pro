@@ -40,13 +40,28 @@ HEADERS += \
     mlsdblogging.h \
     mlsdbprovider.h \
     mlsdbonlinelocator.h \
+    mlsdbcelllocator.h \
+    mlsdbcells.h \
+    mlsdbsnapshot.h \
+    mlsdbstartuptrace.h \
+    mlsdbsettings.h \
+    mlsdbidlepolicy.h \
+    mlsdbpositionfilter.h \
+    mlsdbwakeups.h \
     locationtypes.h
 
 SOURCES += \
     main.cpp \
     mlsdblogging.cpp \
     mlsdbprovider.cpp \
-    mlsdbonlinelocator.cpp
+    mlsdbonlinelocator.cpp \
+    mlsdbcelllocator.cpp \
+    mlsdbsnapshot.cpp \
+    mlsdbstartuptrace.cpp \
+    mlsdbsettings.cpp \
+    mlsdbidlepolicy.cpp \
+    mlsdbpositionfilter.cpp \
+    mlsdbwakeups.cpp
 
 OTHER_FILES = \
     $${dbus_geoclue.files} \
@@ -9,12 +9,14 @@ Source1: %{name}.privileges
 BuildRequires: pkgconfig(Qt5Core)
 BuildRequires: pkgconfig(Qt5DBus)
 BuildRequires: pkgconfig(Qt5Network)
+BuildRequires: pkgconfig(Qt5Test)
 BuildRequires: pkgconfig(qofono-qt5)
 BuildRequires: pkgconfig(qofonoext)
 BuildRequires: pkgconfig(connman-qt5)
 BuildRequires: pkgconfig(libsailfishkeyprovider)
 BuildRequires: pkgconfig(qt5-boostable)
 BuildRequires: pkgconfig(mlite5)
+BuildRequires: pkgconfig(zlib)
 Requires: mapplauncherd-qt5
 Requires: %{name}-agreements
 
@@ -34,6 +36,13 @@ Requires:  %{name} = %{version}
 %description tool
 %{summary}.
 
+%package tests
+Summary:   Tests for geoclue-provider-mlsdb
+Requires:  %{name} = %{version}
+
+%description tests
+%{summary}.
+
 %package data-in
 Summary:   Cell id to location data (.in)
 Requires:  %{name} = %{version}
@@ -84,12 +93,15 @@ cp -a mlsdbtool/geoclue_tool_wrapper.sh %{buildroot}/usr/bin
 %{_bindir}/geoclue-mlsdb-tool
 %{_bindir}/geoclue_tool_wrapper.sh
 
+%files tests
+/opt/tests/geoclue-provider-mlsdb
+
 %files data-in
-%{_datadir}/geoclue-provider-mlsdb/data/404.dat
-%{_datadir}/geoclue-provider-mlsdb/data/405.dat
+%{_datadir}/geoclue-provider-mlsdb/data/404.*
+%{_datadir}/geoclue-provider-mlsdb/data/405.*
 
 %files data-fi
-%{_datadir}/geoclue-provider-mlsdb/data/244.dat
+%{_datadir}/geoclue-provider-mlsdb/data/244.*
 
 %files data-au
-%{_datadir}/geoclue-provider-mlsdb/data/505.dat
+%{_datadir}/geoclue-provider-mlsdb/data/505.*
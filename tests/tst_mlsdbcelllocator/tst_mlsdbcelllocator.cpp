@@ -0,0 +1,187 @@
+/*
+    Copyright (C) 2022 Jolla Ltd.
+    Contact: Daniel Suni <daniel.suni@jolla.com>
+
+    This file is part of geoclue-mlsdb.
+
+    Geoclue-mlsdb is free software; you can redistribute it and/or
+    modify it under the terms of the GNU Lesser General Public
+    License as published by the Free Software Foundation; either
+    version 2.1 of the License.
+*/
+
+#include <QtCore/QLoggingCategory>
+#include <QtCore/QTemporaryDir>
+#include <QtTest/QSignalSpy>
+#include <QtTest/QtTest>
+
+#include "mlsdbcelllocator.h"
+#include "mlsdbsnapshot.h"
+
+#include <stdlib.h>
+
+/*
+    Every allocation made through malloc() is counted while counting is set,
+    including the ones made by operator new.
+*/
+extern "C" void *__libc_malloc(size_t size);
+extern "C" void *__libc_calloc(size_t count, size_t size);
+extern "C" void *__libc_realloc(void *pointer, size_t size);
+
+namespace {
+    QAtomicInt allocations;
+    bool counting = false;
+
+    const quint16 TestMcc = 750; // no data file is shipped for it
+    const quint64 SnapshotDataStamp = 1;
+
+    MlsdbCellPositioningData testCell(quint32 cellId, quint32 signalStrength)
+    {
+        MlsdbCellPositioningData cell;
+        cell.uniqueCellId = getMlsdbUniqueCellId(MLSDB_CELL_TYPE_LTE, cellId, 100, TestMcc, 1);
+        cell.signalStrength = signalStrength;
+        return cell;
+    }
+}
+
+extern "C" void *malloc(size_t size)
+{
+    if (counting)
+        allocations.ref();
+    return __libc_malloc(size);
+}
+
+extern "C" void *calloc(size_t count, size_t size)
+{
+    if (counting)
+        allocations.ref();
+    return __libc_calloc(count, size);
+}
+
+extern "C" void *realloc(void *pointer, size_t size)
+{
+    if (counting)
+        allocations.ref();
+    return __libc_realloc(pointer, size);
+}
+
+class tst_MlsdbCellLocator : public QObject
+{
+    Q_OBJECT
+
+private Q_SLOTS:
+    void initTestCase();
+    void steadyStateDoesNotAllocate();
+    void latestRequestIsEstimated();
+    void snapshotKeepsRecentCells();
+
+private:
+    QTemporaryDir m_dir;
+    MlsdbSnapshot m_snapshot;
+    MlsdbSeenCells m_cells;
+};
+
+/*
+    Three cells are in the snapshot, which is where the locator finds them
+    first, and one is in neither the snapshot nor the data files.
+*/
+void tst_MlsdbCellLocator::initTestCase()
+{
+    QLoggingCategory::setFilterRules(QStringLiteral("geoclue.provider.mlsdb*.debug=false"));
+    qRegisterMetaType<Location>();
+    QVERIFY(m_dir.isValid());
+
+    QVector<MlsdbCellLocator::CachedCell> cells;
+    for (quint32 i = 0; i < 3; ++i) {
+        MlsdbCellLocator::CachedCell cell;
+        cell.uniqueCellId = testCell(1000 + i, 0).uniqueCellId;
+        cell.location.coords.lat = 60.17 + i * 0.01;
+        cell.location.coords.lon = 24.94 + i * 0.01;
+        cell.location.range = 1000;
+        cell.location.samples = 20;
+        cell.lastUsed = 1;
+        cell.known = true;
+        cells.append(cell);
+        m_cells.append(testCell(1000 + i, 20 + i));
+    }
+    m_cells.append(testCell(2000, 10));
+
+    const QString path = m_dir.path() + QStringLiteral("/snapshot");
+    QVERIFY(MlsdbSnapshot::write(path, SnapshotDataStamp, Location(), MlsdbSnapshot::OnlineState(),
+                                 QVector<qint64>(), cells, 0));
+    QVERIFY(m_snapshot.map(path, SnapshotDataStamp));
+}
+
+/*
+    Once the cells have been looked up, estimating the position from the same
+    cells again must not allocate, as that is what the provider does on every
+    update while the device stays put.
+*/
+void tst_MlsdbCellLocator::steadyStateDoesNotAllocate()
+{
+    MlsdbCellLocator locator(&m_snapshot);
+    const Location cold = locator.estimateLocationFromCells(m_cells);
+    QVERIFY(cold.timestamp() != 0);
+    QCOMPARE(locator.cache().size(), m_cells.size());
+
+    allocations.store(0);
+    counting = true;
+    const Location warm = locator.estimateLocationFromCells(m_cells);
+    counting = false;
+
+    QCOMPARE(allocations.load(), 0);
+    QCOMPARE(warm.latitude(), cold.latitude());
+    QCOMPARE(warm.longitude(), cold.longitude());
+    QCOMPARE(warm.accuracy().horizontal(), cold.accuracy().horizontal());
+}
+
+void tst_MlsdbCellLocator::latestRequestIsEstimated()
+{
+    MlsdbCellLocator locator(&m_snapshot);
+    QSignalSpy spy(&locator, &MlsdbCellLocator::locationEstimated);
+
+    MlsdbSeenCells unknownCells;
+    unknownCells.append(testCell(2000, 10));
+    locator.requestEstimate(1, unknownCells);
+    locator.requestEstimate(2, m_cells);
+
+    QTRY_COMPARE(spy.count(), 1);
+    QCOMPARE(spy.at(0).at(0).value<quint64>(), Q_UINT64_C(2));
+    QVERIFY(spy.at(0).at(1).value<Location>().timestamp() != 0);
+}
+
+/*
+    The snapshot has room for fewer cells than there are here, and the one
+    which has been used least recently is left out, although it has the
+    lowest id.
+*/
+void tst_MlsdbCellLocator::snapshotKeepsRecentCells()
+{
+    const int count = 4097;
+    QVector<MlsdbCellLocator::CachedCell> cells;
+    for (int i = 0; i < count; ++i) {
+        MlsdbCellLocator::CachedCell cell;
+        cell.uniqueCellId = testCell(3000 + i, 0).uniqueCellId;
+        cell.location.coords.lat = 60;
+        cell.location.coords.lon = 25;
+        cell.location.range = 0;
+        cell.location.samples = 0;
+        cell.lastUsed = i == 0 ? 1 : 2;
+        cell.known = true;
+        cells.append(cell);
+    }
+
+    const QString path = m_dir.path() + QStringLiteral("/recent");
+    QVERIFY(MlsdbSnapshot::write(path, SnapshotDataStamp, Location(), MlsdbSnapshot::OnlineState(),
+                                 QVector<qint64>(), cells, 0));
+    MlsdbSnapshot snapshot;
+    QVERIFY(snapshot.map(path, SnapshotDataStamp));
+    MlsdbCellLocator::CellLocation location;
+    QVERIFY(!snapshot.findCell(cells.first().uniqueCellId, &location));
+    QVERIFY(snapshot.findCell(cells.at(1).uniqueCellId, &location));
+    QVERIFY(snapshot.findCell(cells.last().uniqueCellId, &location));
+}
+
+QTEST_GUILESS_MAIN(tst_MlsdbCellLocator)
+
+#include "tst_mlsdbcelllocator.moc"
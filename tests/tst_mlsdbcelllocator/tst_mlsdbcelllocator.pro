@@ -0,0 +1,27 @@
+TARGET = tst_mlsdbcelllocator
+CONFIG += testcase
+CONFIG -= app_bundle
+TEMPLATE = app
+
+QT = core testlib
+
+target.path = /opt/tests/geoclue-provider-mlsdb
+
+PLUGIN = $$PWD/../../plugin
+INCLUDEPATH += $$PLUGIN
+
+include (../../common/common.pri)
+HEADERS += \
+    $$PLUGIN/mlsdbcelllocator.h \
+    $$PLUGIN/mlsdbcells.h \
+    $$PLUGIN/mlsdblogging.h \
+    $$PLUGIN/mlsdbsnapshot.h \
+    $$PLUGIN/locationtypes.h
+
+SOURCES += \
+    tst_mlsdbcelllocator.cpp \
+    $$PLUGIN/mlsdbcelllocator.cpp \
+    $$PLUGIN/mlsdblogging.cpp \
+    $$PLUGIN/mlsdbsnapshot.cpp
+
+INSTALLS += target